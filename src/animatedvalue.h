@@ -1,55 +1,241 @@
 #pragma once
 
-#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <string>
+#include <vector>
+
+// Unit cubic-bezier timing curve with fixed end points (0,0) and (1,1), as in CSS.
+struct CubicBezier
+{
+    double x1, y1, x2, y2;
+
+    // progress at time tNorm: solves x(s) = tNorm for s, then returns y(s)
+    double Evaluate(double tNorm) const
+    {
+        if (tNorm <= 0)
+            return 0;
+
+        if (tNorm >= 1)
+            return 1;
+
+        const double cx = 3 * x1, bx = 3 * (x2 - x1) - cx, ax = 1 - cx - bx;
+        const double cy = 3 * y1, by = 3 * (y2 - y1) - cy, ay = 1 - cy - by;
+
+        auto sampleX = [&](double s)
+        { return ((ax * s + bx) * s + cx) * s; };
+
+        // Newton's method converges in a few steps for well-behaved curves
+        double s = tNorm;
+
+        for (int i = 0; i < 8; i++)
+        {
+            const double error = sampleX(s) - tNorm;
+
+            if (std::abs(error) < 1e-7)
+                return ((ay * s + by) * s + cy) * s;
+
+            const double slope = (3 * ax * s + 2 * bx) * s + cx;
+
+            if (std::abs(slope) < 1e-6)
+                break;
+
+            s -= error / slope;
+        }
+
+        // flat spots: fall back to bisection, x(s) is monotonic on [0, 1]
+        double low = 0, high = 1;
+        s = tNorm;
+
+        for (int i = 0; i < 32 && high - low > 1e-7; i++)
+        {
+            if (sampleX(s) < tNorm)
+                low = s;
+            else
+                high = s;
+
+            s = (low + high) / 2;
+        }
+
+        return ((ay * s + by) * s + cy) * s;
+    }
+
+    bool operator==(const CubicBezier &other) const
+    {
+        return x1 == other.x1 && y1 == other.y1 && x2 == other.x2 && y2 == other.y2;
+    }
+
+    // the CSS keyword curves
+    static constexpr CubicBezier Ease() { return {0.25, 0.1, 0.25, 1.0}; }
+    static constexpr CubicBezier EaseIn() { return {0.42, 0.0, 1.0, 1.0}; }
+    static constexpr CubicBezier EaseOut() { return {0.0, 0.0, 0.58, 1.0}; }
+    static constexpr CubicBezier EaseInOut() { return {0.42, 0.0, 0.58, 1.0}; }
+};
+
+enum class Easing : uint8_t
+{
+    Linear,
+    EaseInQuad,
+    EaseOutQuad,
+    EaseInOutQuad,
+    EaseInCubic,
+    EaseOutCubic,
+    EaseInOutCubic,
+    Bezier // uses AnimatedValue::curve
+};
+
+// Maps normalized time to normalized progress. A switch over a closed enum the
+// compiler can inline, instead of an indirect call per value per frame.
+inline double EasingProgress(Easing easing, double tNorm, const CubicBezier &curve = CubicBezier::Ease())
+{
+    switch (easing)
+    {
+    case Easing::Linear:
+        return tNorm;
+    case Easing::EaseInQuad:
+        return tNorm * tNorm;
+    case Easing::EaseOutQuad:
+        return 1 - (1 - tNorm) * (1 - tNorm);
+    case Easing::EaseInOutQuad:
+        if (tNorm < 0.5)
+            return 2 * tNorm * tNorm;
+        else
+            return 1 - 2 * (1 - tNorm) * (1 - tNorm);
+    case Easing::EaseInCubic:
+        return tNorm * tNorm * tNorm;
+    case Easing::EaseOutCubic:
+        return 1 - (1 - tNorm) * (1 - tNorm) * (1 - tNorm);
+    case Easing::EaseInOutCubic:
+        if (tNorm < 0.5)
+            return 4 * tNorm * tNorm * tNorm;
+        else
+            return 1 - 4 * (1 - tNorm) * (1 - tNorm) * (1 - tNorm);
+    case Easing::Bezier:
+        return curve.Evaluate(tNorm);
+    }
+
+    return tNorm;
+}
+
 struct AnimatedValue
 {
     double startValue, endValue;
 
-    std::function<void(AnimatedValue *sender, double tNorm, double value)> onValueChanged;
-
     std::string description = "";
 
-    std::function<double(double start, double end, double tNorm)> easingFunction = Linear;
+    Easing easing = Easing::Linear;
+
+    CubicBezier curve = CubicBezier::Ease();
+};
 
-    static double Linear(double start, double end, double tNorm)
+// Structure-of-arrays store for the values of one animation. All values share the
+// same normalized time, so the easing is evaluated once per distinct curve and the
+// per-value work is a single multiply-add over contiguous arrays.
+class AnimatedValueSet
+{
+public:
+    void Assign(const std::vector<AnimatedValue> &animatedValues)
     {
-        return start + (end - start) * tNorm;
+        Clear();
+
+        starts.reserve(animatedValues.size());
+        deltas.reserve(animatedValues.size());
+        curveIndices.reserve(animatedValues.size());
+
+        for (const auto &value : animatedValues)
+        {
+            starts.push_back(value.startValue);
+            deltas.push_back(value.endValue - value.startValue);
+            curveIndices.push_back(CurveIndex(value.easing, value.curve));
+            descriptions.push_back(value.description);
+        }
+
+        values = starts;
+        progress.assign(curves.size(), 0.0);
     }
 
-    static double EaseInQuad(double start, double end, double tNorm)
+    void Clear()
     {
-        return start + (end - start) * tNorm * tNorm;
+        starts.clear();
+        deltas.clear();
+        values.clear();
+        curveIndices.clear();
+        descriptions.clear();
+        curves.clear();
+        progress.clear();
     }
 
-    static double EaseOutQuad(double start, double end, double tNorm)
+    void Evaluate(double tNorm)
     {
-        return start + (end - start) * (1 - (1 - tNorm) * (1 - tNorm));
+        for (size_t c = 0; c < curves.size(); c++)
+        {
+            progress[c] = EasingProgress(curves[c].easing, tNorm, curves[c].curve);
+        }
+
+        const size_t count = values.size();
+        const double *start = starts.data();
+        const double *delta = deltas.data();
+        const uint32_t *curveIndex = curveIndices.data();
+        const double *curveProgress = progress.data();
+        double *value = values.data();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            value[i] = start[i] + delta[i] * curveProgress[curveIndex[i]];
+        }
     }
 
-    static double EaseInOutQuad(double start, double end, double tNorm)
+    void ResetToStart()
     {
-        if (tNorm < 0.5)
-            return start + (end - start) * 2 * tNorm * tNorm;
-        else
-            return start + (end - start) * (1 - 2 * (1 - tNorm) * (1 - tNorm));
+        values = starts;
     }
 
-    static double EaseInCubic(double start, double end, double tNorm)
+    size_t Size() const
     {
-        return start + (end - start) * tNorm * tNorm * tNorm;
+        return values.size();
     }
 
-    static double EaseOutCubic(double start, double end, double tNorm)
+    bool Empty() const
     {
-        return start + (end - start) * (1 - (1 - tNorm) * (1 - tNorm) * (1 - tNorm));
+        return values.empty();
     }
 
-    static double EaseInOutCubic(double start, double end, double tNorm)
+    double Value(size_t index) const
     {
-        if (tNorm < 0.5)
-            return start + (end - start) * 4 * tNorm * tNorm * tNorm;
-        else
-            return start + (end - start) * (1 - 4 * (1 - tNorm) * (1 - tNorm) * (1 - tNorm));
+        return values[index];
+    }
+
+    const std::string &Description(size_t index) const
+    {
+        return descriptions[index];
+    }
+
+private:
+    struct Curve
+    {
+        Easing easing;
+        CubicBezier curve;
+    };
+
+    uint32_t CurveIndex(Easing easing, const CubicBezier &curve)
+    {
+        for (size_t c = 0; c < curves.size(); c++)
+        {
+            if (curves[c].easing == easing && (easing != Easing::Bezier || curves[c].curve == curve))
+            {
+                return static_cast<uint32_t>(c);
+            }
+        }
+
+        curves.push_back({easing, curve});
+        return static_cast<uint32_t>(curves.size() - 1);
     }
-};
\ No newline at end of file
+
+    std::vector<double> starts, deltas, values;
+    std::vector<uint32_t> curveIndices;
+    std::vector<std::string> descriptions;
+
+    std::vector<Curve> curves;
+    std::vector<double> progress;
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <wx/wx.h>
+#include <wx/display.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <set>
+#include <vector>
+
+// App-wide frame clock. Every running animation is driven from one timer firing
+// at the target frame rate, and each window with running animations gets a single
+// Refresh per frame no matter how many animations it has.
+//
+// Animations of windows that are hidden or minimized are paused: their time does
+// not advance and their window is not refreshed. While everything is paused the
+// timer drops to a slow poll so a minimized app does not keep waking up at 60 Hz.
+class AnimationClock : public wxEvtHandler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    class Client
+    {
+    public:
+        virtual ~Client() = default;
+
+        // advances to the given time; a finished client calls Remove on itself
+        virtual void Advance(Clock::time_point now) = 0;
+
+        // called instead of Advance for every frame the client spends paused
+        virtual void Pause(Clock::duration frameTime) = 0;
+
+        // window refreshed after each frame; may be null
+        virtual wxWindow *GetWindow() const = 0;
+    };
+
+    static constexpr double DefaultFps = 60;
+    static constexpr int PausedPollMs = 250;
+
+    // never destroyed, so no timer outlives the toolkit at exit
+    static AnimationClock &Get()
+    {
+        static AnimationClock *clock = new AnimationClock();
+        return *clock;
+    }
+
+    // 0 follows the refresh rate of the display the first animated window is on
+    void SetTargetFps(double fps)
+    {
+        targetFps = fps;
+        RestartTimer();
+    }
+
+    double GetTargetFps() const
+    {
+        return targetFps > 0 ? targetFps : displayFps;
+    }
+
+    void Add(Client *client)
+    {
+        if (targetFps <= 0 && displayFps <= 0)
+        {
+            displayFps = DisplayRefreshRate(client->GetWindow());
+        }
+
+        if (clients.empty())
+        {
+            lastTick = Clock::now();
+        }
+
+        clients.push_back(client);
+        RestartTimer();
+    }
+
+    void Remove(Client *client)
+    {
+        clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+
+        if (clients.empty())
+        {
+            timer.Stop();
+            paused = false;
+        }
+    }
+
+    bool IsActive(const Client *client) const
+    {
+        return std::find(clients.begin(), clients.end(), client) != clients.end();
+    }
+
+private:
+    AnimationClock()
+    {
+        timer.SetOwner(this);
+        Bind(wxEVT_TIMER, &AnimationClock::OnTimer, this);
+    }
+
+    static double DisplayRefreshRate(const wxWindow *window)
+    {
+        if (!window)
+        {
+            return DefaultFps;
+        }
+
+        wxDisplay display(window);
+
+        const int refresh = display.IsOk() ? display.GetCurrentMode().GetRefresh() : 0;
+
+        return refresh > 0 ? refresh : DefaultFps;
+    }
+
+    static bool IsVisible(wxWindow *window)
+    {
+        if (!window)
+        {
+            return true;
+        }
+
+        if (!window->IsShownOnScreen())
+        {
+            return false;
+        }
+
+        auto topLevel = dynamic_cast<wxTopLevelWindow *>(wxGetTopLevelParent(window));
+
+        return !topLevel || !topLevel->IsIconized();
+    }
+
+    void RestartTimer()
+    {
+        if (clients.empty())
+        {
+            return;
+        }
+
+        const int intervalMs = paused ? PausedPollMs : std::max(1, static_cast<int>(std::lround(1000.0 / GetTargetFps())));
+
+        if (!timer.IsRunning() || timer.GetInterval() != intervalMs)
+        {
+            timer.Start(intervalMs);
+        }
+    }
+
+    void OnTimer(wxTimerEvent &event)
+    {
+        const auto now = Clock::now();
+        const auto frameTime = now - lastTick;
+        lastTick = now;
+
+        std::set<wxWindow *> windowsToRefresh;
+        bool anyVisible = false;
+
+        // clients may stop or start animations from their callbacks
+        const std::vector<Client *> frameClients = clients;
+
+        for (Client *client : frameClients)
+        {
+            if (!IsActive(client))
+            {
+                continue;
+            }
+
+            wxWindow *window = client->GetWindow();
+
+            if (!IsVisible(window))
+            {
+                client->Pause(frameTime);
+                continue;
+            }
+
+            anyVisible = true;
+
+            if (window)
+            {
+                windowsToRefresh.insert(window);
+            }
+
+            client->Advance(now);
+        }
+
+        for (wxWindow *window : windowsToRefresh)
+        {
+            window->Refresh();
+        }
+
+        paused = !anyVisible;
+        RestartTimer();
+    }
+
+    std::vector<Client *> clients;
+    wxTimer timer;
+
+    double targetFps = 0;
+    double displayFps = 0;
+
+    bool paused = false;
+    Clock::time_point lastTick;
+};
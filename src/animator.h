@@ -8,26 +8,42 @@
 #include <functional>
 
 #include "animatedvalue.h"
+#include "animationclock.h"
 
-class Animator : public wxEvtHandler
+// Runs a set of animated values over a fixed duration. Frames come from the shared
+// AnimationClock; an animator given a window has that window refreshed once per
+// frame and pauses while it is hidden or minimized.
+class Animator : public AnimationClock::Client
 {
 public:
-    Animator()
+    Animator(wxWindow *window = nullptr) : window(window)
     {
-        timer.SetOwner(this);
-        Bind(wxEVT_TIMER, &Animator::OnTimer, this);
     }
 
+    ~Animator()
+    {
+        AnimationClock::Get().Remove(this);
+    }
+
+    Animator(const Animator &) = delete;
+    Animator &operator=(const Animator &) = delete;
+
     void SetAnimatedValues(const std::vector<AnimatedValue> &values)
     {
-        animatedValues = values;
+        animatedValues.Assign(values);
     }
 
-    const std::vector<AnimatedValue> &GetAnimatedValues() const
+    const AnimatedValueSet &GetAnimatedValues() const
     {
         return animatedValues;
     }
 
+    // current value of the index-th animated value, as of the last frame
+    double GetValue(size_t index) const
+    {
+        return animatedValues.Value(index);
+    }
+
     void SetOnIteration(const std::function<void()> &onIter)
     {
         this->onIter = onIter;
@@ -40,7 +56,7 @@ public:
 
     void Start(double durationMs)
     {
-        if (animatedValues.empty())
+        if (animatedValues.Empty())
             throw std::runtime_error("No animated values");
 
         if (durationMs <= 0)
@@ -49,44 +65,40 @@ public:
         animationDurationMs = durationMs;
         startTime = std::chrono::steady_clock::now();
 
-        timer.Start(10);
+        if (!IsRunning())
+        {
+            AnimationClock::Get().Add(this);
+        }
     }
 
     void Stop()
     {
-        timer.Stop();
-        onStop();
+        AnimationClock::Get().Remove(this);
+
+        if (onStop)
+        {
+            onStop();
+        }
     }
 
     void Reset()
     {
-        for (auto &value : animatedValues)
+        animatedValues.ResetToStart();
+
+        if (onIter)
         {
-            value.onValueChanged(&value, 0.0, value.startValue);
+            onIter();
         }
     }
 
     bool IsRunning() const
     {
-        return timer.IsRunning();
+        return AnimationClock::Get().IsActive(this);
     }
 
-private:
-    wxTimer timer;
-
-    std::vector<AnimatedValue> animatedValues;
-
-    std::function<void()> onIter;
-    std::function<void()> onStop;
-
-    std::chrono::steady_clock::time_point startTime;
-
-    double animationDurationMs;
-
-    void OnTimer(wxTimerEvent &event)
+    void Advance(std::chrono::steady_clock::time_point now) override
     {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
+        const double elapsedMs = std::chrono::duration<double, std::milli>(now - startTime).count();
 
         if (elapsedMs >= animationDurationMs)
         {
@@ -96,12 +108,34 @@ private:
 
         double tNorm = elapsedMs / animationDurationMs;
 
-        for (auto &value : animatedValues)
+        animatedValues.Evaluate(tNorm);
+
+        if (onIter)
         {
-            double callbackValue = value.easingFunction(value.startValue, value.endValue, tNorm);
-            value.onValueChanged(&value, tNorm, callbackValue);
+            onIter();
         }
+    }
 
-        onIter();
+    void Pause(std::chrono::steady_clock::duration frameTime) override
+    {
+        // a paused animation resumes where it left off instead of jumping ahead
+        startTime += frameTime;
     }
-};
\ No newline at end of file
+
+    wxWindow *GetWindow() const override
+    {
+        return window;
+    }
+
+private:
+    wxWindow *window;
+
+    AnimatedValueSet animatedValues;
+
+    std::function<void()> onIter;
+    std::function<void()> onStop;
+
+    std::chrono::steady_clock::time_point startTime;
+
+    double animationDurationMs;
+};
@@ -0,0 +1,1047 @@
+#include <wx/wx.h>
+#include <wx/graphics.h>
+#include <wx/filename.h>
+#include <wx/mstream.h>
+#include <wx/stdpaths.h>
+#include <wx/utils.h>
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "animatedvalue.h"
+#include "animator.h"
+#include "bitmapgallery.h"
+#include "catalogindex.h"
+#include "catalogsnapshot.h"
+#include "catalogstore.h"
+#include "metrics.h"
+#include "pixelbufferpool.h"
+#include "product.h"
+#include "progressivedecoder.h"
+#include "productparser.h"
+
+// Heap accounting for the memory benchmarks: every allocation carries a header
+// so frees can be subtracted again. Only allocations made inside a HeapCounting
+// scope record their size there and touch the counters; the other benchmarks
+// pay for the header alone.
+namespace
+{
+    std::atomic<bool> heapCounting{false};
+    std::atomic<size_t> liveHeapBytes{0};
+    std::atomic<size_t> heapAllocations{0};
+
+    constexpr size_t AllocationHeader = alignof(std::max_align_t);
+
+    // counts allocations from construction to destruction
+    struct HeapCounting
+    {
+        HeapCounting()
+        {
+            heapCounting = true;
+        }
+
+        ~HeapCounting()
+        {
+            heapCounting = false;
+        }
+    };
+}
+
+void *operator new(size_t size)
+{
+    auto block = static_cast<char *>(std::malloc(size + AllocationHeader));
+
+    if (!block)
+    {
+        throw std::bad_alloc();
+    }
+
+    const bool counted = heapCounting.load(std::memory_order_relaxed);
+    *reinterpret_cast<size_t *>(block) = counted ? size : 0;
+
+    if (counted)
+    {
+        liveHeapBytes += size;
+        heapAllocations++;
+    }
+
+    return block + AllocationHeader;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (!pointer)
+    {
+        return;
+    }
+
+    auto block = static_cast<char *>(pointer) - AllocationHeader;
+
+    if (const size_t size = *reinterpret_cast<size_t *>(block))
+    {
+        liveHeapBytes -= size;
+    }
+
+    std::free(block);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+// Calls into malloc itself, from any library, for the decode pipeline: wx
+// allocates image pixels with malloc, which operator new never sees. Counting
+// needs interposing, which only glibc makes simple; elsewhere the malloc
+// wrappers are not built and the counts are reported as unavailable.
+#if defined(__GLIBC__)
+#define BENCH_COUNTS_MALLOC
+
+namespace
+{
+    std::atomic<size_t> mallocCalls{0};
+    std::atomic<size_t> largeMallocCalls{0};
+
+    // anything this size is an image buffer, not bookkeeping
+    constexpr size_t LargeAllocationBytes = PixelBufferPool::MinClassBytes;
+
+    void CountMalloc(size_t size)
+    {
+        if (!heapCounting.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        mallocCalls++;
+
+        if (size >= LargeAllocationBytes)
+        {
+            largeMallocCalls++;
+        }
+    }
+}
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *pointer, size_t size);
+
+    void *malloc(size_t size)
+    {
+        CountMalloc(size);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        CountMalloc(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *pointer, size_t size)
+    {
+        CountMalloc(size);
+        return __libc_realloc(pointer, size);
+    }
+}
+#endif
+
+// Offscreen benchmarks. Nothing is shown and nothing touches the network;
+// every fixture is generated in code, so runs are comparable across machines
+// and commits.
+//
+// Each measurement is printed as one JSON object per line, e.g.
+//
+//     {"bench":"json_parse","products":1000,"bytes":612345,"mean_ms":1.9,...}
+//
+// so results can be collected and diffed by a script. --only=name,name runs a
+// subset.
+class Benchmarks
+{
+public:
+    Benchmarks(bool haveDisplay, std::set<std::string> only, const wxString &executable)
+        : haveDisplay(haveDisplay), only(std::move(only)), executable(executable)
+    {
+    }
+
+    void Run()
+    {
+        Maybe("json_parse", &Benchmarks::BenchJsonParse);
+        Maybe("image_decode", &Benchmarks::BenchImageDecode);
+        Maybe("decode_pipeline", &Benchmarks::BenchDecodePipeline);
+        Maybe("gallery_paint", &Benchmarks::BenchGalleryPaint);
+        Maybe("easing_frame", &Benchmarks::BenchEasing);
+        Maybe("animator_tick", &Benchmarks::BenchAnimatorTick);
+        Maybe("catalog_store", &Benchmarks::BenchCatalogStore);
+        Maybe("catalog_snapshot", &Benchmarks::BenchCatalogSnapshot);
+        Maybe("catalog_query", &Benchmarks::BenchCatalogQuery);
+
+        // the decode_pipeline variants, each run by it in a process of its own
+        Only("decode_pipeline_pooled", &Benchmarks::BenchDecodePooled);
+        Only("decode_pipeline_rescale", &Benchmarks::BenchDecodeRescale);
+    }
+
+private:
+    static constexpr int PaintIterations = 200;
+    static constexpr int EasingFrames = 10000;
+    static constexpr size_t CatalogSize = 100000;
+    static constexpr int DecodeBatches = 4;
+    static constexpr int DecodeBatchSize = 12;
+
+    // repeated measurements run for at least this long
+    static constexpr double MinSampleMs = 200;
+
+    bool haveDisplay;
+    std::set<std::string> only;
+    wxString executable;
+
+    void Maybe(const std::string &name, void (Benchmarks::*bench)())
+    {
+        if (only.empty() || only.count(name) > 0)
+        {
+            (this->*bench)();
+        }
+    }
+
+    // for benchmarks that only run when asked for by name
+    void Only(const std::string &name, void (Benchmarks::*bench)())
+    {
+        if (only.count(name) > 0)
+        {
+            (this->*bench)();
+        }
+    }
+
+    static void Report(const nlohmann::json &result)
+    {
+        std::printf("%s\n", result.dump().c_str());
+        std::fflush(stdout);
+    }
+
+    // mean time of one call of `work` in milliseconds, over as many calls as fit
+    // in MinSampleMs (at least one)
+    template <typename F>
+    static double MeanMs(F &&work)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        int runs = 0;
+        double elapsedMs = 0;
+
+        do
+        {
+            work();
+            runs++;
+            elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsedMs < MinSampleMs);
+
+        return elapsedMs / runs;
+    }
+
+    // A products page as the feed sends it, with the fields the app ignores too.
+    static std::string FixturePayload(size_t count)
+    {
+        const auto products = FixtureProducts(count);
+        nlohmann::json list = nlohmann::json::array();
+
+        for (size_t i = 0; i < products.size(); i++)
+        {
+            const Product &product = products[i];
+
+            list.push_back({{"id", i + 1},
+                            {"title", product.title},
+                            {"description", product.description},
+                            {"category", product.category},
+                            {"price", product.price},
+                            {"discountPercentage", 7.17},
+                            {"rating", product.rating},
+                            {"stock", 5},
+                            {"tags", {product.category, "featured"}},
+                            {"brand", product.brand},
+                            {"dimensions", {{"width", 23.17}, {"height", 14.43}, {"depth", 28.01}}},
+                            {"reviews", {{{"rating", 2}, {"comment", "Very unhappy with my purchase!"}, {"reviewerName", "John Doe"}}, {{"rating", 5}, {"comment", "Great value for money!"}, {"reviewerName", "Jane Roe"}}}},
+                            {"images", product.imageUrls},
+                            {"thumbnail", product.thumbnailUrl}});
+        }
+
+        return nlohmann::json{{"products", list}, {"total", count}, {"skip", 0}, {"limit", count}}.dump();
+    }
+
+    // Parses a page of 30 (the default page), 1k and 100k products with the
+    // streaming parser the app uses, and with a DOM parse for reference.
+    void BenchJsonParse()
+    {
+        for (size_t count : {size_t(30), size_t(1000), size_t(100000)})
+        {
+            const std::string payload = FixturePayload(count);
+            const auto begin = reinterpret_cast<const unsigned char *>(payload.data());
+            const auto end = begin + payload.size();
+
+            size_t parsed = 0;
+
+            const double streamingMs = MeanMs([&]()
+                                              {
+                                                  parsed = 0;
+                                                  ProductParser::Parse(begin, end, [&parsed](Product &&product)
+                                                                       {
+                                                                           parsed++;
+                                                                           return true; }); });
+
+            const double domMs = MeanMs([&]()
+                                        {
+                                            auto document = nlohmann::json::parse(payload);
+                                            parsed = document["products"].size(); });
+
+            Report({{"bench", "json_parse"},
+                    {"products", count},
+                    {"parsed", parsed},
+                    {"bytes", payload.size()},
+                    {"streaming_ms", streamingMs},
+                    {"dom_ms", domMs},
+                    {"streaming_mb_per_s", payload.size() / 1e3 / streamingMs}});
+        }
+    }
+
+    // Smooth gradients with a little noise, so the encoders compress it about as
+    // well as a product photo; a flat colour would flatter PNG.
+    static wxImage FixtureImage(int width, int height)
+    {
+        wxImage image(width, height);
+        unsigned char *pixel = image.GetData();
+        uint32_t noise = 12345;
+
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                noise = noise * 1664525 + 1013904223;
+                const int grain = static_cast<int>(noise >> 28);
+
+                *pixel++ = static_cast<unsigned char>(x * 255 / width + grain);
+                *pixel++ = static_cast<unsigned char>(y * 255 / height + grain);
+                *pixel++ = static_cast<unsigned char>((x + y) * 127 / (width + height) + 64 + grain);
+            }
+        }
+
+        return image;
+    }
+
+    static std::vector<unsigned char> Encode(const wxImage &image, wxBitmapType type)
+    {
+        wxMemoryOutputStream stream;
+        image.SaveFile(stream, type);
+
+        std::vector<unsigned char> bytes(stream.GetLength());
+        stream.CopyTo(bytes.data(), bytes.size());
+
+        return bytes;
+    }
+
+    // Decodes PNG and JPEG fixtures from thumbnail to large photo size, the way
+    // the loader does: from memory, with the format sniffed from the bytes.
+    void BenchImageDecode()
+    {
+        struct Format
+        {
+            const char *name;
+            wxBitmapType type;
+        };
+
+        for (const Format &format : {Format{"png", wxBITMAP_TYPE_PNG}, Format{"jpeg", wxBITMAP_TYPE_JPEG}})
+        {
+            for (const wxSize &size : {wxSize(160, 120), wxSize(800, 600), wxSize(2048, 1536)})
+            {
+                wxImage source = FixtureImage(size.GetWidth(), size.GetHeight());
+                source.SetOption(wxIMAGE_OPTION_QUALITY, 85);
+
+                const std::vector<unsigned char> bytes = Encode(source, format.type);
+                bool ok = false;
+
+                const double decodeMs = MeanMs([&]()
+                                               {
+                                                   wxMemoryInputStream stream(bytes.data(), bytes.size());
+                                                   ok = wxImage(stream).IsOk(); });
+
+                Report({{"bench", "image_decode"},
+                        {"format", format.name},
+                        {"width", size.GetWidth()},
+                        {"height", size.GetHeight()},
+                        {"bytes", bytes.size()},
+                        {"ok", ok},
+                        {"mean_ms", decodeMs}});
+            }
+        }
+    }
+
+    // A few gallery batches of JPEG photos in the sizes the feed serves, each
+    // decoded as the loader does and shrunk to fit an 800x600 cell.
+    static std::vector<std::vector<unsigned char>> FixturePhotos()
+    {
+        std::vector<std::vector<unsigned char>> photos;
+
+        for (const wxSize &size : {wxSize(2048, 1536), wxSize(1600, 1200), wxSize(1024, 768)})
+        {
+            wxImage source = FixtureImage(size.GetWidth(), size.GetHeight());
+            source.SetOption(wxIMAGE_OPTION_QUALITY, 85);
+            photos.push_back(Encode(source, wxBITMAP_TYPE_JPEG));
+        }
+
+        return photos;
+    }
+
+    // The pooled decode pipeline against the one it replaced, each variant in a
+    // child process, so that neither inherits the other's peak RSS. The pooled
+    // variant decodes into a full-size buffer from a PixelBufferPool and
+    // downscales into another; the old one decodes into a fresh wxImage and
+    // Rescale allocates the smaller copy anew, for every image.
+    void BenchDecodePipeline()
+    {
+        for (const char *variant : {"pooled", "rescale"})
+        {
+            wxArrayString output, errors;
+            const long status = wxExecute(wxString::Format("\"%s\" --only=decode_pipeline_%s", executable, variant), output, errors, wxEXEC_SYNC);
+
+            if (status != 0 || output.empty())
+            {
+                Report({{"bench", "decode_pipeline"}, {"variant", variant}, {"failed", status}});
+                continue;
+            }
+
+            for (const wxString &line : output)
+            {
+                std::printf("%s\n", static_cast<const char *>(line.utf8_str()));
+            }
+
+            std::fflush(stdout);
+        }
+    }
+
+    // Runs DecodeBatches batches of DecodeBatchSize photos through `decode`,
+    // which shrinks each to fit `cell`, and reports time, allocations and peak
+    // RSS around them:
+    //
+    //     allocations           calls into malloc, including operator new
+    //     large_allocations     those of image size; two per image for rescale,
+    //                           only until the pool is warm for pooled
+    //     peak_rss_*            of this process, which runs nothing else
+    template <typename F>
+    void DecodePipeline(const char *variant, F &&decode, const std::function<nlohmann::json()> &extra = {})
+    {
+        const auto photos = FixturePhotos();
+        const wxSize cell(800, 600);
+
+        HeapCounting counting;
+
+#if defined(BENCH_COUNTS_MALLOC)
+        const size_t mallocBefore = mallocCalls, largeBefore = largeMallocCalls;
+#endif
+        const size_t rssBefore = Metrics::PeakResidentBytes();
+        const auto start = std::chrono::steady_clock::now();
+
+        size_t converted = 0;
+
+        for (int batch = 0; batch < DecodeBatches; batch++)
+        {
+            // the gallery holds one batch of bitmaps at a time
+            std::vector<wxBitmap> bitmaps;
+
+            for (int i = 0; i < DecodeBatchSize; i++)
+            {
+                // bitmaps need a display; without one the pipeline stops at the pixels
+                std::optional<wxBitmap> bitmap = decode(photos[(batch + i) % photos.size()], cell);
+
+                if (bitmap)
+                {
+                    bitmaps.push_back(*bitmap);
+                }
+
+                converted++;
+            }
+        }
+
+        const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        const size_t rssAfter = Metrics::PeakResidentBytes();
+
+        nlohmann::json result = {{"bench", "decode_pipeline"},
+                                 {"variant", variant},
+                                 {"images", converted},
+                                 {"bitmaps", haveDisplay},
+                                 {"mean_ms", totalMs / converted},
+                                 {"peak_rss_before_bytes", rssBefore},
+                                 {"peak_rss_after_bytes", rssAfter},
+                                 {"peak_rss_growth_bytes", rssAfter - rssBefore}};
+
+#if defined(BENCH_COUNTS_MALLOC)
+        result["allocations"] = mallocCalls - mallocBefore;
+        result["large_allocations"] = largeMallocCalls - largeBefore;
+#else
+        result["allocations"] = "unavailable";
+        result["large_allocations"] = "unavailable";
+#endif
+
+        if (extra)
+        {
+            result.update(extra());
+        }
+
+        Report(result);
+    }
+
+    static wxSize FitSize(int width, int height, const wxSize &cell)
+    {
+        const double scale = std::min(double(cell.GetWidth()) / width, double(cell.GetHeight()) / height);
+
+        return wxSize(std::max(1, int(width * scale)), std::max(1, int(height * scale)));
+    }
+
+    // the loader's path: the decoder writes into a pooled full-size buffer, the
+    // box filter into a pooled small one, then a raw-access copy into the bitmap
+    void BenchDecodePooled()
+    {
+        auto pool = std::make_shared<PixelBufferPool>();
+
+        DecodePipeline(
+            "pooled", [&](const std::vector<unsigned char> &bytes, const wxSize &cell)
+            {
+                auto decoder = ProgressiveDecoder::Create(bytes.data(), bytes.size(), pool);
+
+                if (!decoder || !decoder->Feed(bytes.data(), bytes.size()) || !decoder->IsComplete())
+                {
+                    return std::optional<wxBitmap>();
+                }
+
+                const PixelBuffer &full = *decoder->GetPixels();
+                const wxSize target = FitSize(full.GetWidth(), full.GetHeight(), cell);
+
+                auto pixels = pool->Acquire(target.GetWidth(), target.GetHeight(), full.Alpha() != nullptr);
+                DownscaleInto(full.Rgb(), full.Alpha(), full.GetWidth(), full.GetHeight(), *pixels);
+
+                return haveDisplay ? std::optional<wxBitmap>(pixels->ToBitmap()) : std::nullopt; },
+            [&]()
+            {
+                const auto stats = pool->GetStats();
+                return nlohmann::json{{"decode_buffer", "pooled"},
+                                      {"pixel_buffers_acquired", stats.acquired},
+                                      {"pixel_buffers_allocated", stats.allocated}};
+            });
+    }
+
+    // the previous path: wx decodes into a fresh wxImage, Rescale makes a
+    // resampled copy, then wxBitmap(wxImage)
+    void BenchDecodeRescale()
+    {
+        DecodePipeline(
+            "rescale", [&](const std::vector<unsigned char> &bytes, const wxSize &cell)
+            {
+                wxMemoryInputStream stream(bytes.data(), bytes.size());
+                wxImage image(stream);
+
+                const wxSize target = FitSize(image.GetWidth(), image.GetHeight(), cell);
+                image.Rescale(target.GetWidth(), target.GetHeight(), wxIMAGE_QUALITY_HIGH);
+
+                return haveDisplay ? std::optional<wxBitmap>(wxBitmap(image)) : std::nullopt; },
+            []()
+            {
+                return nlohmann::json{{"decode_buffer", "fresh wxImage per image"}};
+            });
+    }
+
+    static wxImage FixtureCellImage(int width, int height, unsigned char shade)
+    {
+        wxImage image(width, height);
+        image.SetRGB(wxRect(0, 0, width, height), shade, 255 - shade, shade / 2);
+
+        return image;
+    }
+
+    // Paints the gallery's cells into a wxImage for every scaling mode and a
+    // growing number of images, through the same BitmapGallery::DrawCells the
+    // window uses. Drawing into an image needs no display, so this runs headless
+    // too. The time per paint should stay flat with the image count: only the
+    // visible cells are drawn. Each case is timed with the native bitmaps kept
+    // across paints (mean_us) and converted on every paint, as before the
+    // gallery cached them (uncached_mean_us).
+    void BenchGalleryPaint()
+    {
+        const wxSize cellSize(800, 600);
+
+        wxImage target(cellSize);
+        wxGraphicsRenderer *renderer = wxGraphicsRenderer::GetDefaultRenderer();
+        std::unique_ptr<wxGraphicsContext> gc(renderer ? renderer->CreateContextFromImage(target) : nullptr);
+
+        if (!gc)
+        {
+            Report({{"bench", "gallery_paint"}, {"skipped", "no graphics context for an image"}});
+            return;
+        }
+
+        struct Mode
+        {
+            const char *name;
+            BitmapScaling scaling;
+        };
+
+        for (const Mode &mode : {Mode{"center", BitmapScaling::Center}, Mode{"fit", BitmapScaling::Fit}, Mode{"fill_width", BitmapScaling::FillWidth}, Mode{"fill_height", BitmapScaling::FillHeight}})
+        {
+            for (int imageCount : {1, 10, 100})
+            {
+                std::vector<wxImage> images;
+                std::vector<wxGraphicsBitmap> graphicsBitmaps;
+
+                for (int i = 0; i < imageCount; i++)
+                {
+                    images.push_back(FixtureCellImage(640, 480, static_cast<unsigned char>(i * 37)));
+                    graphicsBitmaps.push_back(renderer->CreateBitmapFromImage(images.back()));
+                }
+
+                const int selected = imageCount / 2;
+
+                auto paint = [&](bool cached)
+                {
+                    BitmapGallery::DrawCells(
+                        gc.get(), cellSize, selected, BitmapGallery::VisibleCells(selected, images.size()), mode.scaling,
+                        [](int dip)
+                        { return dip; },
+                        [&](int i, wxSize &size, bool &placeholder) -> const wxGraphicsBitmap *
+                        {
+                            // as every paint was before the native copies were kept
+                            if (!cached)
+                            {
+                                graphicsBitmaps[i] = renderer->CreateBitmapFromImage(images[i]);
+                            }
+
+                            size = images[i].GetSize();
+                            return &graphicsBitmaps[i];
+                        },
+                        [](int) {});
+                };
+
+                const double cachedUs = TimePaints(gc.get(), [&]()
+                                                   { paint(true); });
+
+                const double uncachedUs = TimePaints(gc.get(), [&]()
+                                                     { paint(false); });
+
+                Report({{"bench", "gallery_paint"},
+                        {"scaling", mode.name},
+                        {"images", imageCount},
+                        {"iterations", PaintIterations},
+                        {"mean_us", cachedUs},
+                        {"uncached_mean_us", uncachedUs}});
+            }
+        }
+
+        gc.reset();
+    }
+
+    // mean time of one of PaintIterations paints in microseconds, flushed
+    template <typename F>
+    static double TimePaints(wxGraphicsContext *gc, F &&paint)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < PaintIterations; i++)
+        {
+            paint();
+        }
+
+        gc->Flush();
+
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / PaintIterations;
+    }
+
+    // the per-value representation Animator used before AnimatedValueSet
+    struct FunctionAnimatedValue
+    {
+        double startValue, endValue;
+        std::function<void(FunctionAnimatedValue *sender, double tNorm, double value)> onValueChanged;
+        std::function<double(double start, double end, double tNorm)> easingFunction;
+    };
+
+    // Evaluates an animation frame for 1, 10 and 1000 concurrent values, through
+    // std::function callbacks and easings versus the structure-of-arrays store.
+    void BenchEasing()
+    {
+        for (int valueCount : {1, 10, 1000})
+        {
+            std::vector<double> sink(valueCount);
+
+            std::vector<FunctionAnimatedValue> functionValues;
+            std::vector<AnimatedValue> setValues;
+
+            for (int i = 0; i < valueCount; i++)
+            {
+                functionValues.push_back({0.0, double(i),
+                                          [&sink, i](FunctionAnimatedValue *, double, double value)
+                                          { sink[i] = value; },
+                                          [](double start, double end, double tNorm)
+                                          { return start + (end - start) * EasingProgress(Easing::EaseInOutCubic, tNorm); }});
+
+                setValues.push_back({0.0, double(i), "", Easing::EaseInOutCubic});
+            }
+
+            AnimatedValueSet set;
+            set.Assign(setValues);
+
+            const double functionNs = TimeFrames([&](double tNorm)
+                                                 {
+                                                     for (auto &value : functionValues)
+                                                     {
+                                                         value.onValueChanged(&value, tNorm, value.easingFunction(value.startValue, value.endValue, tNorm));
+                                                     } });
+
+            const double setNs = TimeFrames([&](double tNorm)
+                                            { set.Evaluate(tNorm); });
+
+            Report({{"bench", "easing_frame"}, {"values", valueCount}, {"function_ns", functionNs}, {"set_ns", setNs}});
+        }
+    }
+
+    // One Animator frame, as the animation clock drives it: elapsed time, easing
+    // of every value and the iteration callback. Frames are fed directly, so
+    // no timer or event loop is involved.
+    void BenchAnimatorTick()
+    {
+        for (int valueCount : {1, 10, 1000})
+        {
+            std::vector<AnimatedValue> values;
+
+            for (int i = 0; i < valueCount; i++)
+            {
+                values.push_back({0.0, double(i), "", i % 2 ? Easing::EaseInOutCubic : Easing::Bezier, CubicBezier::Ease()});
+            }
+
+            double sink = 0;
+
+            Animator animator;
+            animator.SetAnimatedValues(values);
+            animator.SetOnIteration([&animator, &sink]()
+                                    { sink += animator.GetValue(0); });
+
+            // long enough that no frame below reaches the end
+            constexpr double durationMs = 1e9;
+            animator.Start(durationMs);
+
+            const auto origin = std::chrono::steady_clock::now();
+
+            const double tickNs = TimeFrames([&](double tNorm)
+                                             { animator.Advance(origin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(tNorm * durationMs))); });
+
+            animator.SetOnStop(nullptr);
+            animator.Stop();
+
+            Report({{"bench", "animator_tick"}, {"values", valueCount}, {"tick_ns", tickNs}});
+        }
+    }
+
+    // Synthetic catalog shaped like the dummyjson feed: a few dozen brands and
+    // categories, a paragraph of description and three image URLs per product.
+    static std::vector<Product> FixtureProducts(size_t count)
+    {
+        static const char *categories[] = {"beauty", "fragrances", "furniture", "groceries", "home-decoration", "kitchen-accessories", "laptops", "mens-shirts", "mens-shoes", "mens-watches", "mobile-accessories", "motorcycle", "skin-care", "smartphones", "sports-accessories", "sunglasses", "tablets", "tops", "vehicle", "womens-bags", "womens-dresses", "womens-jewellery", "womens-shoes", "womens-watches"};
+        constexpr size_t categoryCount = sizeof(categories) / sizeof(categories[0]);
+        constexpr size_t brandCount = 40;
+
+        std::vector<Product> products;
+        products.reserve(count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const std::string category = categories[i % categoryCount];
+            const std::string title = "Product " + std::to_string(i) + " " + category;
+
+            Product product;
+            product.title = title;
+            product.price = 1 + (i * 7919 % 100000) / 100.0;
+            product.brand = "Brand " + std::to_string(i * 31 % brandCount);
+            product.category = category;
+            product.rating = (i * 13 % 500) / 100.0;
+            product.description = "The " + title + " is a dependable everyday pick, combining solid build quality with a clean design and a price that leaves room in the budget for the rest of the list.";
+
+            for (int image = 1; image <= 3; image++)
+            {
+                product.imageUrls.push_back("https://cdn.dummyjson.com/products/images/" + category + "/" + title + "/" + std::to_string(image) + ".png");
+            }
+
+            product.thumbnailUrl = "https://cdn.dummyjson.com/products/images/" + category + "/" + title + "/thumbnail.png";
+
+            products.push_back(std::move(product));
+        }
+
+        return products;
+    }
+
+    // Memory and load time of 100k products as a vector of Product versus the
+    // columnar CatalogStore.
+    void BenchCatalogStore()
+    {
+        const auto fixtures = FixtureProducts(CatalogSize);
+
+        size_t vectorBytes, storeBytes;
+        double vectorMs, storeMs;
+
+        {
+            HeapCounting counting;
+
+            const size_t before = liveHeapBytes;
+            const auto start = std::chrono::steady_clock::now();
+
+            std::vector<Product> products;
+
+            for (const auto &product : fixtures)
+            {
+                products.push_back(product);
+            }
+
+            vectorMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            vectorBytes = liveHeapBytes - before;
+        }
+
+        {
+            auto input = fixtures;
+
+            HeapCounting counting;
+            const size_t before = liveHeapBytes;
+            const auto start = std::chrono::steady_clock::now();
+
+            CatalogStore store;
+            store.Append(std::move(input));
+
+            storeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            storeBytes = liveHeapBytes - before;
+        }
+
+        Report({{"bench", "catalog_store"},
+                {"items", CatalogSize},
+                {"vector_bytes", vectorBytes},
+                {"vector_ms", vectorMs},
+                {"store_bytes", storeBytes},
+                {"store_ms", storeMs}});
+    }
+
+    // Startup cost of 100k products: writing the snapshot, then mapping and
+    // validating it again, against building the store from parsed products.
+    void BenchCatalogSnapshot()
+    {
+        CatalogStore store;
+        store.Append(FixtureProducts(CatalogSize));
+
+        const wxString path = wxFileName(wxFileName::GetTempDir(), "bench_catalog.snapshot").GetFullPath();
+        const std::string source = "bench";
+
+        auto start = std::chrono::steady_clock::now();
+        const bool written = CatalogSnapshot::Write(store, source, path);
+        const double writeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        const auto loaded = CatalogSnapshot::Load(path, source);
+        const double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        Report({{"bench", "catalog_snapshot"},
+                {"items", CatalogSize},
+                {"written", written},
+                {"write_ms", writeMs},
+                {"loaded", loaded ? loaded->Size() : 0},
+                {"load_ms", loadMs}});
+
+        wxRemoveFile(path);
+    }
+
+    // Search over 100k products: building the index, then each query through
+    // the index against a linear scan of the columns, which also checks that
+    // both find the same products.
+    void BenchCatalogQuery()
+    {
+        CatalogStore store;
+        store.Append(FixtureProducts(CatalogSize));
+
+        CatalogIndex index;
+        const auto start = std::chrono::steady_clock::now();
+        index.Update(store);
+        const double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        static const char *queries[] = {
+            "category=laptops AND price<100",
+            "brand=\"Brand 7\" AND rating>=4",
+            "price>=500 AND price<510",
+            "rating>4.5",
+            "dependable laptops",
+            "text:product AND 4242",
+            "category=tablets AND price<=200 AND rating>1",
+        };
+
+        nlohmann::json results = nlohmann::json::array();
+        bool allAgree = true;
+
+        for (const char *text : queries)
+        {
+            const auto query = CatalogQuery::Parse(text);
+
+            if (!query)
+            {
+                results.push_back({{"query", text}, {"parsed", false}});
+                allAgree = false;
+                continue;
+            }
+
+            CatalogIndex::Ids indexed, scanned;
+
+            const double indexMs = MeanMs([&]()
+                                          { indexed = index.Run(*query, store); });
+            const double scanMs = MeanMs([&]()
+                                         { scanned = ScanCatalog(*query, store); });
+
+            allAgree = allAgree && indexed == scanned;
+
+            results.push_back({{"query", text},
+                               {"matches", indexed.size()},
+                               {"index_ms", indexMs},
+                               {"scan_ms", scanMs},
+                               {"agrees", indexed == scanned}});
+        }
+
+        Report({{"bench", "catalog_query"},
+                {"items", CatalogSize},
+                {"index_build_ms", buildMs},
+                {"agrees", allAgree},
+                {"queries", results}});
+    }
+
+    // the brute-force answer to `query`: every product checked clause by clause
+    static CatalogIndex::Ids ScanCatalog(const CatalogQuery &query, const CatalogStore &store)
+    {
+        CatalogIndex::Ids ids;
+        std::vector<std::string> words;
+
+        for (size_t i = 0; i < store.Size(); i++)
+        {
+            words.clear();
+            CatalogQuery::Tokenize(store.Title(i), words);
+            CatalogQuery::Tokenize(store.Description(i), words);
+
+            const bool matches = std::all_of(query.clauses.begin(), query.clauses.end(), [&](const CatalogQuery::Clause &clause)
+                                             {
+                                                 switch (clause.field)
+                                                 {
+                                                 case CatalogQuery::Field::Brand:
+                                                     return CatalogQuery::Lowercase(store.Label(store.BrandIds()[i])) == clause.text;
+                                                 case CatalogQuery::Field::Category:
+                                                     return CatalogQuery::Lowercase(store.Label(store.CategoryIds()[i])) == clause.text;
+                                                 case CatalogQuery::Field::Text:
+                                                     return std::find(words.begin(), words.end(), clause.text) != words.end();
+                                                 case CatalogQuery::Field::Price:
+                                                     return Compare(clause.comparison, store.Prices()[i], clause.number);
+                                                 case CatalogQuery::Field::Rating:
+                                                     // the column is float; so is the bound the index compares with
+                                                     return Compare(clause.comparison, store.Ratings()[i], static_cast<float>(clause.number));
+                                                 }
+
+                                                 return false; });
+
+            if (matches)
+            {
+                ids.push_back(static_cast<uint32_t>(i));
+            }
+        }
+
+        return ids;
+    }
+
+    static bool Compare(CatalogQuery::Comparison comparison, double value, double bound)
+    {
+        switch (comparison)
+        {
+        case CatalogQuery::Comparison::Less:
+            return value < bound;
+        case CatalogQuery::Comparison::LessOrEqual:
+            return value <= bound;
+        case CatalogQuery::Comparison::Greater:
+            return value > bound;
+        case CatalogQuery::Comparison::GreaterOrEqual:
+            return value >= bound;
+        case CatalogQuery::Comparison::Equal:
+            return value == bound;
+        }
+
+        return false;
+    }
+
+    template <typename F>
+    static double TimeFrames(F &&frame)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < EasingFrames; i++)
+        {
+            frame(double(i) / EasingFrames);
+        }
+
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / EasingFrames;
+    }
+};
+
+// Only turning decoded pixels into wxBitmaps needs a GUI session; everything
+// else, the gallery paint included, runs on wxBase, wxImage and a graphics
+// context over an image. Without a display (CI, ssh) wx is started as a
+// console app instead and decode_pipeline stops at the pixels.
+static bool HaveDisplay()
+{
+#if defined(__WXGTK__) || defined(__WXX11__)
+    return std::getenv("DISPLAY") || std::getenv("WAYLAND_DISPLAY");
+#else
+    return true;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    std::set<std::string> only;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+
+        if (argument.rfind("--only=", 0) == 0)
+        {
+            std::string names = argument.substr(7);
+            size_t start = 0;
+
+            while (start <= names.size())
+            {
+                const size_t comma = std::min(names.find(',', start), names.size());
+                only.insert(names.substr(start, comma - start));
+                start = comma + 1;
+            }
+        }
+    }
+
+    const bool haveDisplay = HaveDisplay();
+
+    wxApp::SetInstance(haveDisplay ? new wxApp() : new wxAppConsole());
+
+    if (!wxEntryStart(argc, argv))
+    {
+        std::fprintf(stderr, "failed to initialize wxWidgets\n");
+        return 1;
+    }
+
+    wxInitAllImageHandlers();
+
+    // argv[0] may be a bare name found on PATH or relative to another directory
+    Benchmarks(haveDisplay, std::move(only), wxStandardPaths::Get().GetExecutablePath()).Run();
+
+    wxEntryCleanup();
+    return 0;
+}
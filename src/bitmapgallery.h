@@ -3,12 +3,23 @@
 #include <wx/wx.h>
 #include <wx/graphics.h>
 #include <wx/dcbuffer.h>
-
+#include <wx/dcmemory.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "animator.h"
 #include "animatedvalue.h"
 
+#ifdef GALLERY_PROFILER
+#include "frameprofiler.h"
+#endif
+
 enum class BitmapScaling : int
 {
     Center = 0,
@@ -32,34 +43,63 @@ public:
         this->Bind(wxEVT_LEFT_DCLICK, &BitmapGallery::OnLeftDown, this);
         this->Bind(wxEVT_MOTION, &BitmapGallery::OnMouseMove, this);
         this->Bind(wxEVT_LEAVE_WINDOW, &BitmapGallery::OnMouseLeave, this);
+
+        this->Bind(wxEVT_DPI_CHANGED, [this](wxDPIChangedEvent &evt)
+                   {
+                       InvalidateGraphicsResources();
+                       evt.Skip(); });
+
+        this->Bind(wxEVT_SIZE, [this](wxSizeEvent &evt)
+                   {
+                       imageLayerValid = false;
+                       evt.Skip(); });
     }
 
     void OnPaint(wxPaintEvent &evt)
     {
+        CountRepaint();
+
+#ifdef GALLERY_PROFILER
+        FrameProfiler::PaintScope paintScope(profiler);
+#endif
+
         wxAutoBufferedPaintDC dc(this);
         dc.Clear();
 
+        // while sliding every frame shows different pixels, so there is nothing to reuse
+        const bool useImageLayer = !animator.IsRunning() && bitmaps.size() > 0;
+
+        if (useImageLayer)
+        {
+            UpdateImageLayer();
+            dc.DrawBitmap(imageLayer, 0, 0);
+        }
+
         wxGraphicsContext *gc = wxGraphicsContext::Create(dc);
 
         if (gc && bitmaps.size() > 0)
         {
+            PrepareGraphicsResources(gc);
+
             const wxSize drawSize = GetClientSize();
 
-            DrawBitmaps(gc, drawSize);
+            if (!useImageLayer)
+            {
+                DrawBitmaps(gc, drawSize);
+            }
 
             double arrowLineLength = NavigationRectSize().GetWidth() * 2 / 3;
-            double arrowLineWidth = FromDIP(5);
 
             if (shouldShowLeftArrow)
             {
                 DrawNavigationRect(gc, NavigationRectLeft());
-                DrawArrow(gc, NavigationRectLeft(), arrowLineLength, arrowLineWidth, 0);
+                DrawArrow(gc, NavigationRectLeft(), arrowLineLength, 0);
             }
 
             if (shouldShowRightArrow)
             {
                 DrawNavigationRect(gc, NavigationRectRight());
-                DrawArrow(gc, NavigationRectRight(), arrowLineLength, arrowLineWidth, M_PI);
+                DrawArrow(gc, NavigationRectRight(), arrowLineLength, M_PI);
             }
 
             const int dotRadius = FromDIP(4);
@@ -72,6 +112,20 @@ public:
                 DrawDots(gc, drawSize, dotCount, dotRadius, dotSpacing);
             }
         }
+
+        if (gc && HasOverlays())
+        {
+            PrepareGraphicsResources(gc);
+
+#ifdef GALLERY_PROFILER
+            // the profile shows the gallery's frames, not what drawing it costs
+            paintScope.Exclude(gc, [this, gc]()
+                               { DrawOverlays(gc); });
+#else
+            DrawOverlays(gc);
+#endif
+        }
+
         if (gc)
         {
             delete gc;
@@ -80,49 +134,85 @@ public:
 
     void DrawBitmaps(wxGraphicsContext *gc, const wxSize &drawSize)
     {
-        const auto currentTransform = gc->GetTransform();
-        const wxSize dipDrawSize = ToDIP(drawSize);
-
-        gc->Translate(-FromDIP(dipDrawSize.GetWidth()) * selectedIndex, 0);
-
-        if (animator.IsRunning())
+        if (bitmaps.empty())
         {
-            gc->Translate(-FromDIP(dipDrawSize.GetWidth()) * animationOffsetNormalized, 0);
+            return;
         }
 
-        for (const auto &bitmap : bitmaps)
-        {
-            const wxSize bmpSize = bitmap.GetSize();
-
-            // treating image size as DIP
-            double imageW = bmpSize.GetWidth();
-            double imageH = bmpSize.GetHeight();
+        PrepareGraphicsResources(gc);
 
-            if (scaling == BitmapScaling::Fit)
+        DrawCells(
+            gc, ToDIP(drawSize), ViewPosition(), VisibleCells(), scaling,
+            [this](int dip)
+            { return FromDIP(dip); },
+            [this](int i, wxSize &size, bool &placeholder) -> const wxGraphicsBitmap *
             {
-                double scaleX = dipDrawSize.GetWidth() / imageW;
-                double scaleY = dipDrawSize.GetHeight() / imageH;
+                if (!bitmaps[i].IsOk())
+                {
+                    return nullptr;
+                }
 
-                double scale = std::min(scaleX, scaleY);
+                size = bitmaps[i].GetSize();
+                placeholder = placeholders[i];
 
-                imageW *= scale;
-                imageH *= scale;
-            }
-            else if (scaling == BitmapScaling::FillWidth)
+                return &GraphicsBitmapAt(i);
+            },
+            [this](int i)
             {
-                double scaleX = dipDrawSize.GetWidth() / imageW;
+#ifdef GALLERY_PROFILER
+                profiler.OnBitmapDrawn();
+#endif
+
+                if (unpainted[i])
+                {
+                    unpainted[i] = false;
+
+                    if (onFirstPaint)
+                    {
+                        onFirstPaint(i);
+                    }
+                }
+            });
+    }
 
-                imageW *= scaleX;
-                imageH *= scaleX;
-            }
-            else if (scaling == BitmapScaling::FillHeight)
-            {
-                double scaleY = dipDrawSize.GetHeight() / imageH;
+    // The cell drawing of DrawBitmaps, without the window, so the paint benchmark
+    // can render into a wxImage when there is no display. Draws `visibleCells`
+    // of a viewport `viewPosition` cells in: `fromDIP` converts to the context's
+    // pixels, `cellAt(i, size, placeholder)` returns the native bitmap of cell i
+    // (null while it is empty) and `onDrawn(i)` is called for each cell drawn.
+    template <typename ToPixels, typename CellAt, typename OnDrawn>
+    static void DrawCells(wxGraphicsContext *gc, const wxSize &dipDrawSize, double viewPosition, std::pair<int, int> visibleCells, BitmapScaling scaling, ToPixels &&fromDIP, CellAt &&cellAt, OnDrawn &&onDrawn)
+    {
+        const auto currentTransform = gc->GetTransform();
 
-                imageW *= scaleY;
-                imageH *= scaleY;
+        // only the cells the viewport overlaps are drawn, so the paint cost does
+        // not grow with the number of images
+        const auto [firstVisible, lastVisible] = visibleCells;
+
+        gc->Translate(fromDIP(dipDrawSize.GetWidth()) * (firstVisible - viewPosition), 0);
+
+        for (int i = firstVisible; i <= lastVisible; i++)
+        {
+            wxSize bmpSize;
+            bool placeholder = false;
+            const wxGraphicsBitmap *bitmap = cellAt(i, bmpSize, placeholder);
+
+            // a slot whose image has not arrived yet
+            if (!bitmap)
+            {
+                gc->Translate(fromDIP(dipDrawSize.GetWidth()), 0);
+                continue;
             }
 
+            // treating image size as DIP
+            double imageW = bmpSize.GetWidth();
+            double imageH = bmpSize.GetHeight();
+
+            // placeholders are smaller than the image they stand in for; Center
+            // would show them at a fraction of the size
+            const bool scaleUp = placeholder && scaling == BitmapScaling::Center;
+            ScaleToCell(imageW, imageH, dipDrawSize, scaleUp ? BitmapScaling::Fit : scaling);
+
             double cellCenterX = dipDrawSize.GetWidth() / 2;
             double imageCenterX = imageW / 2;
 
@@ -132,31 +222,135 @@ public:
             double bitmapX = cellCenterX - imageCenterX;
             double bitmapY = cellCenterY - imageCenterY;
 
-            gc->Clip(0, 0, FromDIP(dipDrawSize.GetWidth()), FromDIP(dipDrawSize.GetHeight()));
-            gc->DrawBitmap(bitmap, FromDIP(bitmapX), FromDIP(bitmapY), FromDIP(imageW), FromDIP(imageH));
+            gc->Clip(0, 0, fromDIP(dipDrawSize.GetWidth()), fromDIP(dipDrawSize.GetHeight()));
+            gc->DrawBitmap(*bitmap, fromDIP(bitmapX), fromDIP(bitmapY), fromDIP(imageW), fromDIP(imageH));
 
             gc->ResetClip();
 
-            gc->Translate(FromDIP(dipDrawSize.GetWidth()), 0);
+            onDrawn(i);
+
+            gc->Translate(fromDIP(dipDrawSize.GetWidth()), 0);
         }
 
         gc->SetTransform(currentTransform);
     }
 
+    // first and last cell a viewport `viewPosition` cells into `cellCount` overlaps
+    static std::pair<int, int> VisibleCells(double viewPosition, size_t cellCount)
+    {
+        const int lastIndex = std::max(0, static_cast<int>(cellCount) - 1);
+
+        return {std::clamp(static_cast<int>(std::floor(viewPosition)), 0, lastIndex),
+                std::clamp(static_cast<int>(std::ceil(viewPosition)), 0, lastIndex)};
+    }
+
+    // Resizes imageW x imageH to the size it is drawn at in a cell of cellSize.
+    // Pure arithmetic, so the loader also uses it off the GUI thread.
+    static void ScaleToCell(double &imageW, double &imageH, const wxSize &cellSize, BitmapScaling scaling)
+    {
+        if (scaling == BitmapScaling::Fit)
+        {
+            double scaleX = cellSize.GetWidth() / imageW;
+            double scaleY = cellSize.GetHeight() / imageH;
+
+            double scale = std::min(scaleX, scaleY);
+
+            imageW *= scale;
+            imageH *= scale;
+        }
+        else if (scaling == BitmapScaling::FillWidth)
+        {
+            double scaleX = cellSize.GetWidth() / imageW;
+
+            imageW *= scaleX;
+            imageH *= scaleX;
+        }
+        else if (scaling == BitmapScaling::FillHeight)
+        {
+            double scaleY = cellSize.GetHeight() / imageH;
+
+            imageW *= scaleY;
+            imageH *= scaleY;
+        }
+    }
+
+    // size of one cell in physical pixels, i.e. the largest a bitmap is ever drawn
+    wxSize GetCellPixelSize() const
+    {
+        return ToDIP(GetClientSize()) * GetDPIScaleFactor();
+    }
+
+    // diagnostics drawn over the top left corner, one line per '\n'
+    bool HasOverlays() const
+    {
+#ifdef GALLERY_PROFILER
+        if (profiler.enabled)
+        {
+            return true;
+        }
+#endif
+
+        return !overlayText.empty();
+    }
+
+    void DrawOverlays(wxGraphicsContext *gc)
+    {
+        if (!overlayText.empty())
+        {
+            DrawOverlayText(gc);
+        }
+
+#ifdef GALLERY_PROFILER
+        if (profiler.enabled)
+        {
+            profiler.Draw(gc, GetClientRect(), GetDPIScaleFactor(), overlayFont);
+        }
+#endif
+    }
+
+    void DrawOverlayText(wxGraphicsContext *gc)
+    {
+        gc->SetFont(overlayFont);
+
+        double charWidth, lineHeight;
+        gc->GetTextExtent("M", &charWidth, &lineHeight);
+
+        const wxArrayString lines = wxSplit(overlayText, '\n');
+        const double padding = FromDIP(6);
+
+        double textWidth = 0;
+
+        for (const auto &line : lines)
+        {
+            double lineWidth;
+            gc->GetTextExtent(line, &lineWidth, nullptr);
+            textWidth = std::max(textWidth, lineWidth);
+        }
+
+        gc->SetPen(wxNullGraphicsPen);
+        gc->SetBrush(overlayBrush);
+        gc->DrawRectangle(0, 0, textWidth + 2 * padding, lines.size() * lineHeight + 2 * padding);
+
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            gc->DrawText(lines[i], padding, padding + i * lineHeight);
+        }
+    }
+
     void DrawNavigationRect(wxGraphicsContext *gc, const wxRect &rect)
     {
-        gc->SetPen(*wxTRANSPARENT_PEN);
-        gc->SetBrush(wxBrush(wxColor(255, 255, 255, 64)));
+        gc->SetPen(wxNullGraphicsPen);
+        gc->SetBrush(translucentBrush);
 
         gc->DrawRectangle(rect.GetX(), rect.GetY(), rect.GetWidth(), rect.GetHeight());
     }
 
-    void DrawArrow(wxGraphicsContext *gc, const wxRect &rectToCenterIn, double lineLength, double lineWidth, double rotationAngle)
+    void DrawArrow(wxGraphicsContext *gc, const wxRect &rectToCenterIn, double lineLength, double rotationAngle)
     {
         const auto currentTransform = gc->GetTransform();
         const auto rectCenter = rectToCenterIn.GetPosition() + rectToCenterIn.GetSize() / 2;
 
-        gc->SetPen(wxPen(wxColor(255, 255, 255, 255), lineWidth));
+        gc->SetPen(arrowPen);
 
         gc->Translate(rectCenter.x, rectCenter.y);
         gc->Rotate(-M_PI / 4);
@@ -178,18 +372,11 @@ public:
         gc->Translate(-dotsWidth / 2, -dotRadius);
         gc->Translate(drawSize.GetWidth() / 2, drawSize.GetHeight() - dotRadius * 4);
 
+        gc->SetPen(wxNullGraphicsPen);
+
         for (int i = 0; i < dotCount; i++)
         {
-            gc->SetPen(*wxTRANSPARENT_PEN);
-
-            if (i == selectedIndex)
-            {
-                gc->SetBrush(wxBrush(wxColor(255, 255, 255, 255)));
-            }
-            else
-            {
-                gc->SetBrush(wxBrush(wxColor(255, 255, 255, 64)));
-            }
+            gc->SetBrush(i == selectedIndex ? opaqueBrush : translucentBrush);
 
             gc->DrawEllipse(0, 0, dotRadius * 2, dotRadius * 2);
 
@@ -235,27 +422,45 @@ public:
     {
         if (NavigationRectLeft().Contains(evt.GetPosition()))
         {
-            shouldShowLeftArrow = true;
-            Refresh();
+            SetArrowsShown(true, shouldShowRightArrow);
         }
         else if (NavigationRectRight().Contains(evt.GetPosition()))
         {
-            shouldShowRightArrow = true;
-            Refresh();
+            SetArrowsShown(shouldShowLeftArrow, true);
         }
         else
         {
-            shouldShowLeftArrow = false;
-            shouldShowRightArrow = false;
-            Refresh();
+            SetArrowsShown(false, false);
         }
     }
 
     void OnMouseLeave(wxMouseEvent &evt)
     {
-        shouldShowLeftArrow = false;
-        shouldShowRightArrow = false;
-        Refresh();
+        SetArrowsShown(false, false);
+    }
+
+    // motion events arrive far more often than the hover state changes; only a
+    // flip repaints, and only the navigation rect that flipped
+    void SetArrowsShown(bool left, bool right)
+    {
+        if (left != shouldShowLeftArrow)
+        {
+            shouldShowLeftArrow = left;
+            RefreshRect(NavigationRectLeft());
+        }
+
+        if (right != shouldShowRightArrow)
+        {
+            shouldShowRightArrow = right;
+            RefreshRect(NavigationRectRight());
+        }
+    }
+
+    // paints during the last full second, for spotting redundant invalidation;
+    // shown in the demo app's F12 overlay
+    int GetRepaintsPerSecond() const
+    {
+        return repaintsPerSecond;
     }
 
     void AnimateToPrevious()
@@ -293,34 +498,108 @@ public:
         AnimatedValue xOffset = {
             offsetStart,
             offsetTarget,
-            [this](AnimatedValue *sender, double tNorm, double value)
-            {
-                animationOffsetNormalized = value;
-            },
             "xOffset",
-            AnimatedValue::EaseInOutCubic};
+            Easing::EaseInOutCubic};
 
+        // the animation clock refreshes this window once per frame
         animator.SetAnimatedValues({xOffset});
         animator.SetOnIteration([this]()
-                                { Refresh(); });
+                                {
+#ifdef GALLERY_PROFILER
+                                    profiler.OnAnimatorTick();
+#endif
+                                    animationOffsetNormalized = animator.GetValue(0); });
 
         animator.SetOnStop([this, indexTarget]()
                            {
+#ifdef GALLERY_PROFILER
+                               profiler.OnSlideEnd();
+#endif
                                selectedIndex = indexTarget;
                                animationOffsetNormalized = 0;
                                Refresh(); });
 
+#ifdef GALLERY_PROFILER
+        profiler.OnSlideStart();
+#endif
         animator.Start(200);
     }
 
-    std::vector<wxBitmap> bitmaps;
+#ifdef GALLERY_PROFILER
+    // F11 in the demo app
+    void ToggleFrameProfiler()
+    {
+        profiler.enabled = !profiler.enabled;
+        Refresh();
+    }
+#endif
+
     BitmapScaling scaling = BitmapScaling::Center;
 
-    void ResetBitmaps()
+    // shown over the images until set back to empty
+    void SetOverlayText(const wxString &text)
+    {
+        overlayText = text;
+        Refresh();
+    }
+
+    // called the first time a cell is drawn after ReplaceBitmap, e.g. to time
+    // how long a decoded image took to reach the screen
+    void SetOnFirstPaint(const std::function<void(size_t)> &callback)
+    {
+        onFirstPaint = callback;
+    }
+
+    size_t GetBitmapCount() const
+    {
+        return bitmaps.size();
+    }
+
+    int GetSelectedIndex() const
+    {
+        return selectedIndex;
+    }
+
+    void SetSelectedIndex(int index)
+    {
+        selectedIndex = std::clamp(index, 0, std::max(0, static_cast<int>(bitmaps.size()) - 1));
+        Refresh();
+    }
+
+    void AddBitmap(const wxBitmap &bitmap)
+    {
+        bitmaps.push_back(bitmap);
+        graphicsBitmaps.emplace_back();
+        placeholders.push_back(false);
+        unpainted.push_back(false);
+        imageLayerValid = false;
+    }
+
+    // Swaps the image of one cell in place. The selection and any slide in
+    // progress are left alone; only a cell on screen causes a repaint.
+    void ReplaceBitmap(size_t index, const wxBitmap &bitmap)
+    {
+        SetCell(index, bitmap, false);
+    }
+
+    // Shows a stand-in, e.g. the product thumbnail, until ReplaceBitmap delivers
+    // the real image. Placeholders are always drawn scaled to the cell.
+    void SetPlaceholder(size_t index, const wxBitmap &bitmap)
     {
-        auto reset = [this]()
+        SetCell(index, bitmap, true);
+    }
+
+    // Removes all images. With a slot count, the gallery starts out with that many
+    // empty cells, to be filled by SetPlaceholder and ReplaceBitmap in any order.
+    void ResetBitmaps(size_t slotCount = 0)
+    {
+        auto reset = [this, slotCount]()
         {
-            bitmaps.clear();
+            bitmaps.assign(slotCount, wxBitmap());
+            graphicsBitmaps.assign(slotCount, wxGraphicsBitmap());
+            placeholders.assign(slotCount, false);
+            unpainted.assign(slotCount, false);
+            imageLayerValid = false;
             selectedIndex = 0;
             animationOffsetNormalized = 0;
             Refresh();
@@ -337,11 +616,168 @@ public:
         }
     }
 
+    // Drops the native copies of the bitmaps, pens, brushes and font; the next paint
+    // rebuilds them.
+    void InvalidateGraphicsResources()
+    {
+        graphicsRenderer = nullptr;
+        imageLayerValid = false;
+
+        for (auto &graphicsBitmap : graphicsBitmaps)
+        {
+            graphicsBitmap = wxGraphicsBitmap();
+        }
+
+#ifdef GALLERY_PROFILER
+        profiler.InvalidateGraphicsResources();
+#endif
+    }
+
 private:
+    std::vector<wxBitmap> bitmaps;
+    std::vector<bool> placeholders;
+
+    // replaced since last drawn
+    std::vector<bool> unpainted;
+    std::function<void(size_t)> onFirstPaint;
+
+    wxString overlayText;
+
+#ifdef GALLERY_PROFILER
+    FrameProfiler profiler;
+#endif
+
+    void SetCell(size_t index, const wxBitmap &bitmap, bool placeholder)
+    {
+        bitmaps[index] = bitmap;
+        graphicsBitmaps[index] = wxGraphicsBitmap();
+        placeholders[index] = placeholder;
+        unpainted[index] = !placeholder;
+
+        const auto [firstVisible, lastVisible] = VisibleCells();
+
+        if ((int)index >= firstVisible && (int)index <= lastVisible)
+        {
+            imageLayerValid = false;
+            Refresh();
+        }
+    }
+
+    // position of the viewport in cells, fractional while sliding
+    double ViewPosition() const
+    {
+        return animator.IsRunning() ? selectedIndex + animationOffsetNormalized : selectedIndex;
+    }
+
+    std::pair<int, int> VisibleCells() const
+    {
+        return VisibleCells(ViewPosition(), bitmaps.size());
+    }
+
+    // Backend-native copies of the bitmaps, pens, brushes and font. Handing a plain
+    // wxBitmap to DrawBitmap converts it to a native surface on every paint, which
+    // is the bulk of the cost while the slide animation repaints every tick.
+    // Every paint context comes from the default renderer, so the resources stay
+    // usable across paints; they are rebuilt when a bitmap or the DPI changes.
+    // Null until prepared.
+    std::vector<wxGraphicsBitmap> graphicsBitmaps;
+    wxGraphicsRenderer *graphicsRenderer = nullptr;
+
+    wxGraphicsPen arrowPen;
+    wxGraphicsBrush translucentBrush, opaqueBrush;
+    wxGraphicsBrush overlayBrush; // behind the metrics overlay text
+    wxGraphicsFont overlayFont;   // the metrics and profiler overlays
+
+    void PrepareGraphicsResources(wxGraphicsContext *gc)
+    {
+        if (graphicsRenderer)
+        {
+            return;
+        }
+
+        graphicsRenderer = gc->GetRenderer();
+
+        arrowPen = graphicsRenderer->CreatePen(wxGraphicsPenInfo(wxColor(255, 255, 255, 255), FromDIP(5)));
+
+        translucentBrush = graphicsRenderer->CreateBrush(wxBrush(wxColor(255, 255, 255, 64)));
+        opaqueBrush = graphicsRenderer->CreateBrush(wxBrush(wxColor(255, 255, 255, 255)));
+        overlayBrush = graphicsRenderer->CreateBrush(wxBrush(wxColor(0, 0, 0, 160)));
+
+        overlayFont = graphicsRenderer->CreateFont(wxFont(wxFontInfo(9).Family(wxFONTFAMILY_TELETYPE)), *wxWHITE);
+    }
+
+    const wxGraphicsBitmap &GraphicsBitmapAt(size_t index)
+    {
+        if (graphicsBitmaps[index].IsNull())
+        {
+            graphicsBitmaps[index] = graphicsRenderer->CreateBitmap(bitmaps[index]);
+        }
+
+        return graphicsBitmaps[index];
+    }
+
+    // The visible images composited into one bitmap, so hover and dot changes
+    // repaint the overlays over a single blit instead of re-rendering the images.
+    // Rebuilt when the images, the selection, the scaling or the size change.
+    wxBitmap imageLayer;
+    bool imageLayerValid = false;
+    int imageLayerIndex = -1;
+    BitmapScaling imageLayerScaling = BitmapScaling::Center;
+
+    void UpdateImageLayer()
+    {
+        const wxSize drawSize = GetClientSize();
+        const double scaleFactor = GetContentScaleFactor();
+
+        const bool upToDate = imageLayerValid && imageLayer.IsOk() && imageLayerIndex == selectedIndex && imageLayerScaling == scaling && imageLayer.GetLogicalSize() == drawSize && imageLayer.GetScaleFactor() == scaleFactor;
+
+        if (upToDate)
+        {
+            return;
+        }
+
+        imageLayer.CreateWithDIPSize(drawSize, scaleFactor, 32);
+        imageLayer.UseAlpha();
+
+        {
+            wxMemoryDC layerDC(imageLayer);
+            layerDC.SetBackground(wxBrush(GetBackgroundColour()));
+            layerDC.Clear();
+
+            std::unique_ptr<wxGraphicsContext> gc(wxGraphicsContext::Create(layerDC));
+
+            if (gc)
+            {
+                DrawBitmaps(gc.get(), drawSize);
+            }
+        }
+
+        imageLayerValid = true;
+        imageLayerIndex = selectedIndex;
+        imageLayerScaling = scaling;
+    }
+
+    void CountRepaint()
+    {
+        const auto now = std::chrono::steady_clock::now();
+
+        repaintsThisSecond++;
+
+        if (now - repaintWindowStart >= std::chrono::seconds(1))
+        {
+            repaintsPerSecond = repaintsThisSecond;
+            repaintsThisSecond = 0;
+            repaintWindowStart = now;
+        }
+    }
+
+    std::chrono::steady_clock::time_point repaintWindowStart = std::chrono::steady_clock::now();
+    int repaintsThisSecond = 0, repaintsPerSecond = 0;
+
     bool shouldShowLeftArrow = false, shouldShowRightArrow = false;
     int selectedIndex = 0;
 
-    Animator animator;
+    Animator animator{this};
     double animationOffsetNormalized = 0;
 
     wxSize NavigationRectSize()
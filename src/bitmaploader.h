@@ -2,133 +2,1310 @@
 
 #include <wx/wx.h>
 #include <wx/webrequest.h>
+#include <wx/mstream.h>
 
-#include <queue>
+#include <map>
+#include <set>
+#include <memory>
+#include <optional>
+#include <algorithm>
 #include <functional>
+#include <cmath>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <atomic>
 
 #include "bitmapgallery.h"
+#include "workerpool.h"
+#include "lrucache.h"
+#include "httpcache.h"
+#include "metrics.h"
+#include "pixelbufferpool.h"
+#include "progressivedecoder.h"
+#include "requestscheduler.h"
 
+// A decoded bitmap together with what it was derived from. Bitmaps are downscaled
+// to the gallery cell at decode time, so the source bytes are kept to re-derive
+// a sharper copy when the window grows.
+struct CachedBitmap
+{
+    wxBitmap bitmap;
+    std::shared_ptr<const ByteSource> source;
+
+    wxSize decodedFor;
+    BitmapScaling scaling = BitmapScaling::Center;
+    bool downscaled = false;
+
+    bool NeedsRedecode(const wxSize &cellPixels, BitmapScaling currentScaling) const
+    {
+        if (!source)
+        {
+            return false;
+        }
+
+        if (scaling != currentScaling)
+        {
+            return true;
+        }
+
+        return downscaled && (cellPixels.GetWidth() > decodedFor.GetWidth() || cellPixels.GetHeight() > decodedFor.GetHeight());
+    }
+};
+
+using BitmapCache = LruCache<std::string, CachedBitmap>;
+
+// Downloads and decodes the gallery images.
+//
+// The gallery gets one cell per image as soon as a batch starts. The product
+// thumbnail is fetched first, at the highest priority, and stands in for every
+// image still missing; each cell is then replaced in place as its own image is
+// decoded, in whatever order they finish.
+//
+// Bodies are streamed (Storage_None) into the HTTP cache as they arrive, and
+// JPEG and PNG bodies are also fed chunk by chunk to a ProgressiveDecoder on the
+// worker pool, so an image is decoded by the time its last byte is in. While an
+// image of the current batch is still downloading, what the decoder has so far
+// is shown in its cell at most every PartialDecodeIntervalMs: the top of a
+// baseline image, or a coarse pass of a progressive JPEG or interlaced PNG.
+// Without a cache file to write to, such a body is not kept in memory besides;
+// the image then cannot be re-derived from it on resize. Other formats are
+// buffered and decoded by wx once complete.
+//
+// All downloads go through a RequestScheduler. Every gallery slot and every prefetch
+// window entry holds a claim on its URL, so duplicate URLs share one download and
+// switching to another product does not throw work away: the claims of the previous
+// batch are demoted to prefetch and only released with the next prefetch window.
+//
+// Each download is traced through the pipeline (queued, started, first byte,
+// completed, decoded, converted, first painted) into Metrics under "image.*".
 class BitmapLoader : public wxEvtHandler
 {
 public:
-    BitmapLoader(BitmapGallery *gallery) : bitmapView(gallery)
+    static constexpr size_t DefaultMaxConcurrentRequests = 4;
+    static constexpr size_t DefaultCacheBudgetBytes = 64 * 1024 * 1024;
+    static constexpr size_t DefaultMaxPrefetchRequests = 2;
+    static constexpr int ResizeSettleMs = 200;
+    static constexpr int PartialDecodeIntervalMs = 150;
+
+    struct LoadStats
+    {
+        size_t bytesReceived = 0;
+
+        // received by requests that were cancelled, failed or were no longer
+        // wanted by the time they completed
+        size_t wastedBytes = 0;
+        size_t cancelledRequests = 0;
+
+        size_t batchesStarted = 0;
+        size_t batchesCompleted = 0;
+    };
+
+    // times since LoadBitmaps, for a batch whose cells all got their final image
+    // (or failed) before the next batch replaced it
+    struct BatchTiming
+    {
+        size_t imageCount;
+        double firstImageMs; // thumbnail, partial or final image, whichever came first
+        double completeMs;
+    };
+
+    BitmapLoader(BitmapGallery *gallery, HttpCache *httpCache = nullptr, size_t maxConcurrentRequests = DefaultMaxConcurrentRequests, size_t cacheBudgetBytes = DefaultCacheBudgetBytes)
+        : bitmapView(gallery), httpCache(httpCache), cache(cacheBudgetBytes, CachedBitmapBytes), scheduler(std::max<size_t>(1, maxConcurrentRequests), DefaultMaxPrefetchRequests)
+    {
+        this->Bind(wxEVT_WEBREQUEST_STATE, &BitmapLoader::OnWebRequestState, this);
+        this->Bind(wxEVT_WEBREQUEST_DATA, &BitmapLoader::OnWebRequestData, this);
+
+        resizeTimer.SetOwner(this);
+        this->Bind(wxEVT_TIMER, &BitmapLoader::OnResizeSettled, this);
+
+        bitmapView->Bind(wxEVT_SIZE, &BitmapLoader::OnGallerySize, this);
+        bitmapView->SetOnFirstPaint([this](size_t slot)
+                                    { OnSlotPainted(slot); });
+    }
+
+    ~BitmapLoader()
+    {
+        bitmapView->SetOnFirstPaint(nullptr);
+        bitmapView->Unbind(wxEVT_SIZE, &BitmapLoader::OnGallerySize, this);
+    }
+
+    void LoadBitmaps(const std::vector<std::string> &urls, const std::string &thumbnail = {})
+    {
+        wxLogDebug("Loading %zu bitmaps", urls.size());
+
+        bitmapView->ResetBitmaps(urls.size());
+
+        // images of the previous batch that never made it on screen
+        for (auto it = pipelineTraces.begin(); it != pipelineTraces.end();)
+        {
+            if (it->second.bitmapReady)
+            {
+                Metrics::Get().Finish(it->second);
+                it = pipelineTraces.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        // the previous batch stays scheduled, but only as prefetch work
+        for (size_t slot = 0; slot < batchUrls.size(); slot++)
+        {
+            if (slotClaims[slot])
+            {
+                scheduler.Move(batchUrls[slot], *slotClaims[slot], RequestPriority::Prefetch);
+                prefetchClaims.push_back(batchUrls[slot]);
+            }
+        }
+
+        if (thumbnailClaim)
+        {
+            scheduler.Move(thumbnailUrl, *thumbnailClaim, RequestPriority::Prefetch);
+            prefetchClaims.push_back(thumbnailUrl);
+        }
+
+        batchUrls = urls;
+        batchWanted = std::set<std::string>(urls.begin(), urls.end());
+        thumbnailUrl = thumbnail;
+        thumbnailClaim.reset();
+
+        slotFinished.assign(urls.size(), false);
+        slotClaims.assign(urls.size(), std::nullopt);
+        batchLogged = false;
+
+        loadStats.batchesStarted++;
+        batchStart = std::chrono::steady_clock::now();
+        batchFirstImage.reset();
+
+        // one small download puts something in every cell, so it goes first
+        if (!thumbnailUrl.empty())
+        {
+            batchWanted.insert(thumbnailUrl);
+
+            if (auto cached = cache.Find(thumbnailUrl))
+            {
+                ShowThumbnail(cached->bitmap);
+                NoteImageShown();
+            }
+            else
+            {
+                scheduler.Acquire(thumbnailUrl, RequestPriority::Visible);
+                queuedAt.try_emplace(thumbnailUrl, std::chrono::steady_clock::now());
+                thumbnailClaim = RequestPriority::Visible;
+            }
+        }
+
+        for (size_t slot = 0; slot < batchUrls.size(); slot++)
+        {
+            if (auto cached = cache.Find(batchUrls[slot]))
+            {
+                wxLogDebug(" -- Cache hit: %s", batchUrls[slot]);
+                bitmapView->ReplaceBitmap(slot, cached->bitmap);
+                slotFinished[slot] = true;
+                NoteImageShown();
+
+                // show the cached copy now, a sharper one replaces it if needed
+                if (cached->NeedsRedecode(bitmapView->GetCellPixelSize(), bitmapView->scaling))
+                {
+                    QueueRedecode(batchUrls[slot], cached->source);
+                }
+            }
+            else
+            {
+                if (!scheduler.Acquire(batchUrls[slot], RequestPriority::Current))
+                {
+                    wxLogDebug(" -- Joining the request already running for %s", batchUrls[slot]);
+                }
+
+                queuedAt.try_emplace(batchUrls[slot], std::chrono::steady_clock::now());
+
+                slotClaims[slot] = RequestPriority::Current;
+            }
+        }
+
+        CheckBatchComplete();
+        StartRequests();
+    }
+
+    // Warms the caches with URLs that are likely to be needed next, e.g. the images
+    // of neighbouring products, ordered nearest first. Each call replaces the
+    // previous window: its claims are released after the new ones are taken, so
+    // downloads wanted by both windows (or by the current batch) keep running and
+    // the rest are cancelled.
+    void Prefetch(const std::vector<std::string> &urls)
+    {
+        wxLogDebug("Prefetch window of %zu URLs", urls.size());
+
+        prefetchedBytes = 0;
+
+        std::vector<std::string> previousClaims = std::move(prefetchClaims);
+        prefetchClaims.clear();
+
+        for (const auto &url : urls)
+        {
+            if (!cache.Contains(url))
+            {
+                scheduler.Acquire(url, RequestPriority::Prefetch);
+                queuedAt.try_emplace(url, std::chrono::steady_clock::now());
+                prefetchClaims.push_back(url);
+            }
+        }
+
+        for (const auto &url : previousClaims)
+        {
+            if (scheduler.Release(url, RequestPriority::Prefetch))
+            {
+                queuedAt.erase(url);
+                CancelRequestsFor(url);
+            }
+        }
+
+        StartRequests();
+    }
+
+    // limits how much a single prefetch window may add to the caches, so
+    // prefetching never pushes the images on screen out of the memory cache
+    void SetPrefetchBudget(size_t bytes)
+    {
+        prefetchBudgetBytes = bytes;
+    }
+
+    // without decoding, prefetched images only warm the HTTP cache
+    void SetDecodePrefetched(bool decode)
+    {
+        decodePrefetched = decode;
+    }
+
+    bool IsIdle()
+    {
+        return activeRequests.empty();
+    }
+
+    void SetMaxConcurrentRequests(size_t count)
+    {
+        scheduler.SetMaxInFlight(std::max<size_t>(1, count));
+        StartRequests();
+    }
+
+    size_t GetMaxConcurrentRequests() const
+    {
+        return scheduler.GetMaxInFlight();
+    }
+
+    void SetCacheBudget(size_t bytes)
+    {
+        cache.SetBudget(bytes);
+    }
+
+    BitmapCache::Stats GetCacheStats() const
+    {
+        return cache.GetStats();
+    }
+
+    RequestScheduler::Stats GetSchedulerStats() const
+    {
+        return scheduler.GetStats();
+    }
+
+    LoadStats GetLoadStats() const
+    {
+        return loadStats;
+    }
+
+    PixelBufferPool::Stats GetPixelPoolStats() const
+    {
+        return pixelPool->GetStats();
+    }
+
+    void SetOnBatchComplete(const std::function<void(const BatchTiming &)> &callback)
+    {
+        onBatchComplete = callback;
+    }
+
+    void CancelAll(const std::function<void()> &done)
+    {
+        batchWanted.clear();
+        prefetchClaims.clear();
+        slotClaims.assign(slotClaims.size(), std::nullopt);
+        thumbnailClaim.reset();
+
+        for (const auto &url : scheduler.Urls())
+        {
+            if (scheduler.Drop(url))
+            {
+                CancelRequestsFor(url);
+            }
+        }
+
+        queuedAt.clear();
+
+        if (!activeRequests.empty())
+        {
+            finishCallback = done;
+        }
+        else
+        {
+            done();
+        }
+    }
+
+private:
+    // The decoder of one download. Chunks are queued on the GUI thread and fed
+    // on the worker pool by one job at a time, in order; a job runs until the
+    // queue is empty and the next chunk starts another.
+    struct StreamingDecode
+    {
+        std::mutex mutex;
+        std::deque<std::vector<unsigned char>> chunks;
+        bool draining = false;
+
+        // what the images are made for, brought up to date when the body is complete
+        wxSize cellPixels;
+        BitmapScaling scaling = BitmapScaling::Center;
+
+        // no more chunks follow; `source` is the complete body, if it was kept
+        bool ended = false;
+        std::shared_ptr<const ByteSource> source;
+
+        // the download was dropped or its image is not wanted any more
+        std::atomic<bool> abandoned{false};
+
+        // a partial image is on its way to the GUI thread
+        std::atomic<bool> previewPending{false};
+
+        // only used by the job feeding the decoder
+        std::unique_ptr<ProgressiveDecoder> decoder;
+        bool previews = false;
+        size_t previewRows = 0;
+        std::chrono::steady_clock::time_point decodeStart, lastPreview;
+    };
+
+    struct ActiveRequest
+    {
+        wxWebRequest request;
+        std::string url;
+        bool dropped = false;
+        bool repeated = false; // once, after a 304 the cache had no body for
+
+        std::shared_ptr<StreamedBody> body; // null once a decoder takes the place of a buffered one
+        RequestTrace trace;
+        size_t receivedBytes = 0;
+
+        // the first bytes, until the format is known
+        std::vector<unsigned char> head;
+        bool sniffed = false;
+        std::shared_ptr<StreamingDecode> decode;
+    };
+
+    void CancelRequestsFor(const std::string &url)
+    {
+        for (auto &[id, active] : activeRequests)
+        {
+            if (active.url == url && active.request.GetState() == wxWebRequest::State_Active)
+            {
+                wxLogDebug("    Cancelling request for %s.", url);
+                active.dropped = true;
+                active.request.Cancel();
+            }
+        }
+    }
+
+    void StartRequests()
+    {
+        PromoteSelectedSlot();
+
+        while (auto url = scheduler.StartNext(prefetchedBytes < prefetchBudgetBytes))
+        {
+            if (!StartRequest(*url))
+            {
+                CompleteJob(*url);
+                DeliverToSlots(*url, std::nullopt);
+            }
+        }
+    }
+
+    // `repeatOf` carries the trace of a request being repeated without validators
+    bool StartRequest(const std::string &url, std::optional<RequestTrace> repeatOf = std::nullopt)
+    {
+        auto request = wxWebSession::GetDefault().CreateRequest(this, url);
+
+        if (!request.IsOk())
+        {
+            wxLogDebug(" -- Failed to create request for %s", url);
+            return false;
+        }
+
+        if (httpCache)
+        {
+            httpCache->PrepareRequest(request, url);
+        }
+
+        request.SetStorage(wxWebRequest::Storage_None);
+
+        ActiveRequest active{request, url};
+        active.body = httpCache ? httpCache->BeginBody(url) : std::make_shared<StreamedBody>();
+
+        if (repeatOf)
+        {
+            active.trace = std::move(*repeatOf);
+            active.repeated = true;
+        }
+        else
+        {
+            const auto now = std::chrono::steady_clock::now();
+            auto queued = queuedAt.find(url);
+
+            active.trace.kind = "image";
+            active.trace.url = url;
+            active.trace.queued = queued != queuedAt.end() ? queued->second : now;
+            active.trace.started = now;
+
+            if (queued != queuedAt.end())
+            {
+                queuedAt.erase(queued);
+            }
+        }
+
+        activeRequests[request.GetId()] = active;
+        request.Start();
+
+        return true;
+    }
+
+    // Drops the job for `url` along with every claim on it, including the
+    // prefetch window's: left listed, a later Prefetch would release it from a
+    // newer job for the same URL and cancel that instead.
+    void CompleteJob(const std::string &url)
+    {
+        scheduler.Complete(url);
+        prefetchClaims.erase(std::remove(prefetchClaims.begin(), prefetchClaims.end(), url), prefetchClaims.end());
+    }
+
+    // the image in the cell on screen is the one the user is waiting for
+    void PromoteSelectedSlot()
+    {
+        const size_t slot = bitmapView->GetSelectedIndex();
+
+        if (slot < batchUrls.size() && slotClaims[slot] == RequestPriority::Current)
+        {
+            scheduler.Move(batchUrls[slot], RequestPriority::Current, RequestPriority::Visible);
+            slotClaims[slot] = RequestPriority::Visible;
+        }
+    }
+
+    void ShowThumbnail(const wxBitmap &bitmap)
+    {
+        for (size_t slot = 0; slot < batchUrls.size(); slot++)
+        {
+            if (!slotFinished[slot])
+            {
+                bitmapView->SetPlaceholder(slot, bitmap);
+            }
+        }
+    }
+
+    // A failed image leaves its cell with the thumbnail, or empty without one.
+    void DeliverToSlots(const std::string &url, const std::optional<wxBitmap> &bitmap)
+    {
+        if (thumbnailClaim && url == thumbnailUrl)
+        {
+            thumbnailClaim.reset();
+
+            if (bitmap)
+            {
+                ShowThumbnail(*bitmap);
+                NoteImageShown();
+            }
+        }
+
+        for (size_t slot = 0; slot < batchUrls.size(); slot++)
+        {
+            if (!slotFinished[slot] && batchUrls[slot] == url)
+            {
+                if (bitmap)
+                {
+                    bitmapView->ReplaceBitmap(slot, *bitmap);
+                    NoteImageShown();
+                }
+
+                slotFinished[slot] = true;
+                slotClaims[slot].reset();
+            }
+        }
+
+        CheckBatchComplete();
+    }
+
+    void NoteImageShown()
+    {
+        if (!batchFirstImage)
+        {
+            batchFirstImage = std::chrono::steady_clock::now();
+        }
+    }
+
+    void CheckBatchComplete()
+    {
+        if (batchLogged || !std::all_of(slotFinished.begin(), slotFinished.end(), [](bool finished)
+                                        { return finished; }))
+        {
+            return;
+        }
+
+        batchLogged = true;
+        loadStats.batchesCompleted++;
+        LogStats();
+
+        if (onBatchComplete)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            const auto firstImage = batchFirstImage.value_or(now);
+
+            onBatchComplete({batchUrls.size(),
+                             std::chrono::duration<double, std::milli>(firstImage - batchStart).count(),
+                             std::chrono::duration<double, std::milli>(now - batchStart).count()});
+        }
+    }
+
+    void OnWebRequestState(wxWebRequestEvent &event)
+    {
+        if (event.GetState() == wxWebRequest::State_Active || event.GetState() == wxWebRequest::State_Idle)
+        {
+            return;
+        }
+
+        auto it = activeRequests.find(event.GetRequest().GetId());
+
+        if (it == activeRequests.end())
+        {
+            return;
+        }
+
+        const std::string url = it->second.url;
+        const bool dropped = it->second.dropped;
+        const bool repeated = it->second.repeated;
+        const std::shared_ptr<StreamedBody> streamed = it->second.body;
+        const std::shared_ptr<StreamingDecode> decode = it->second.decode;
+        const size_t receivedBytes = it->second.receivedBytes;
+
+        RequestTrace trace = std::move(it->second.trace);
+        trace.completed = std::chrono::steady_clock::now();
+        trace.state = event.GetState();
+        trace.bytes = receivedBytes;
+
+        activeRequests.erase(it);
+
+        wxLogDebug(" -- Request state <%s>: %s", state(event.GetState()), url);
+
+        // the URL may have been scheduled again since this request was dropped;
+        // that newer job must not be completed by the old request's outcome
+        if (dropped)
+        {
+            if (decode)
+            {
+                decode->abandoned = true;
+            }
+
+            loadStats.cancelledRequests++;
+            loadStats.wastedBytes += receivedBytes;
+            Metrics::Get().Finish(trace);
+
+            StartRequests();
+            NotifyIfFinished();
+            return;
+        }
+
+        std::shared_ptr<const ByteSource> body;
+
+        // the decoder that got the body as it arrived; a 304 has none worth decoding
+        std::shared_ptr<StreamingDecode> streamedDecode;
+
+        const auto &response = event.GetResponse();
+
+        if (event.GetState() == wxWebRequest::State_Completed && scheduler.Contains(url) && (response.GetStatus() == 200 || response.GetStatus() == 304))
+        {
+            if (streamed)
+            {
+                body = httpCache ? httpCache->Resolve(url, response, *streamed)
+                                 : streamed->TakeBuffer();
+            }
+
+            if (response.GetStatus() == 200)
+            {
+                streamedDecode = decode;
+            }
+
+            // the entry was evicted while the request was out; ask again, without validators
+            if (!body && response.GetStatus() == 304 && !repeated && !finishCallback && StartRequest(url, std::move(trace)))
+            {
+                if (decode)
+                {
+                    decode->abandoned = true;
+                }
+
+                return;
+            }
+        }
+
+        if (body || streamedDecode)
+        {
+            scheduler.MarkDownloaded(url);
+
+            const bool onlyPrefetched = batchWanted.count(url) == 0;
+
+            if (onlyPrefetched && !decodePrefetched && httpCache && body)
+            {
+                streamedDecode.reset();
+                prefetchedBytes += body->Size();
+                CompleteJob(url);
+                Metrics::Get().Finish(trace);
+            }
+            else
+            {
+                pipelineTraces[url] = std::move(trace);
+
+                if (streamedDecode)
+                {
+                    FinishStreamingDecode(url, streamedDecode, body);
+                }
+                else
+                {
+                    QueueDecode(url, body);
+                }
+            }
+        }
+        else
+        {
+            loadStats.wastedBytes += receivedBytes;
+            Metrics::Get().Finish(trace);
+
+            if (scheduler.Contains(url))
+            {
+                CompleteJob(url);
+                DeliverToSlots(url, std::nullopt);
+            }
+        }
+
+        if (decode && decode != streamedDecode)
+        {
+            decode->abandoned = true;
+        }
+
+        StartRequests();
+        NotifyIfFinished();
+    }
+
+    void OnWebRequestData(wxWebRequestEvent &event)
+    {
+        auto it = activeRequests.find(event.GetRequest().GetId());
+
+        if (it == activeRequests.end())
+        {
+            return;
+        }
+
+        loadStats.bytesReceived += event.GetDataSize();
+        it->second.receivedBytes += event.GetDataSize();
+
+        if (!it->second.trace.firstByte)
+        {
+            it->second.trace.firstByte = std::chrono::steady_clock::now();
+        }
+
+        if (it->second.dropped)
+        {
+            return;
+        }
+
+        ActiveRequest &active = it->second;
+        const auto *data = static_cast<const unsigned char *>(event.GetDataBuffer());
+        const size_t size = event.GetDataSize();
+
+        if (active.body)
+        {
+            active.body->Append(data, size);
+        }
+
+        if (!active.sniffed)
+        {
+            SniffBody(active, data, size);
+        }
+        else if (active.decode)
+        {
+            FeedStreamingDecode(active.url, active.decode, data, size);
+        }
+    }
+
+    static size_t BitmapBytes(const wxBitmap &bitmap)
     {
-        this->Bind(wxEVT_WEBREQUEST_STATE, &BitmapLoader::OnWebRequestState, this);
+        return static_cast<size_t>(bitmap.GetWidth()) * bitmap.GetHeight() * 4;
     }
 
-    void LoadBitmaps(const std::vector<std::string> &urls)
+    static size_t CachedBitmapBytes(const CachedBitmap &cached)
     {
-        wxLogDebug("Loading %zu bitmaps", urls.size());
+        return BitmapBytes(cached.bitmap) + (cached.source ? cached.source->HeapBytes() : 0);
+    }
 
-        if (isIdle)
-        {
-            wxLogDebug("    Idle. Switching to busy.");
-            isIdle = false;
+    // Either the image as decoded by wx or a pooled buffer: the smaller copy a
+    // downscaled image was written into, or the full-size output of a
+    // ProgressiveDecoder.
+    struct DecodedImage
+    {
+        wxImage image;
+        std::shared_ptr<PixelBuffer> pixels;
 
-            wxLogDebug("    Resetting bitmaps.");
-            bitmapView->ResetBitmaps();
+        wxSize decodedFor;
+        BitmapScaling scaling;
+        bool downscaled = false;
 
-            wxLogDebug("    Replacing URLs and starting popping.");
-            urlsToLoad = std::queue<std::string>(std::deque<std::string>(urls.begin(), urls.end()));
+        std::chrono::steady_clock::time_point decodeStart, decodeEnd;
 
-            LoadNextBitmap();
+        bool IsOk() const
+        {
+            return pixels || image.IsOk();
         }
-        else
+
+        wxBitmap ToBitmap() const
+        {
+            return pixels ? pixels->ToBitmap() : wxBitmap(image);
+        }
+    };
+
+    // The size an image of `width` x `height` is drawn at in the cell, if that
+    // is smaller both ways; Center mode draws at natural size.
+    static std::optional<wxSize> DownscaledSize(int width, int height, const wxSize &cellPixels, BitmapScaling scaling)
+    {
+        if (scaling == BitmapScaling::Center || cellPixels.GetWidth() <= 0 || cellPixels.GetHeight() <= 0)
+        {
+            return std::nullopt;
+        }
+
+        double targetW = width;
+        double targetH = height;
+
+        BitmapGallery::ScaleToCell(targetW, targetH, cellPixels, scaling);
+
+        const wxSize target(std::max(1, static_cast<int>(std::ceil(targetW))), std::max(1, static_cast<int>(std::ceil(targetH))));
+
+        if (target.GetWidth() < width && target.GetHeight() < height)
         {
-            wxLogDebug("    Busy. Setting next batch.");
-            nextBatch = urls;
+            return target;
+        }
 
-            if (currentRequest.IsOk() && currentRequest.GetState() == wxWebRequest::State_Active)
+        return std::nullopt;
+    }
+
+    // Runs on a worker thread. JPEG and PNG go through a ProgressiveDecoder in
+    // one go, into a full-size buffer from the pool; anything else, or a file
+    // it gives up on, is left to wx.
+    static std::shared_ptr<DecodedImage> Decode(const ByteSource &bytes, const wxSize &cellPixels, BitmapScaling scaling, const std::shared_ptr<PixelBufferPool> &pixelPool)
+    {
+        const auto decodeStart = std::chrono::steady_clock::now();
+
+        if (auto decoder = ProgressiveDecoder::Create(bytes.Data(), bytes.Size(), pixelPool))
+        {
+            if (decoder->Feed(bytes.Data(), bytes.Size()) && decoder->IsComplete())
             {
-                wxLogDebug("    Cancelling current request.");
-                currentRequest.Cancel();
+                auto decoded = std::make_shared<DecodedImage>();
+                decoded->decodeStart = decodeStart;
+                decoded->decodedFor = cellPixels;
+                decoded->scaling = scaling;
+
+                FitToCell(*decoded, decoder->GetPixels(), false, *pixelPool);
+
+                decoded->decodeEnd = std::chrono::steady_clock::now();
+                return decoded;
             }
         }
+
+        auto decoded = DecodeWithWx(bytes, cellPixels, scaling, *pixelPool);
+        decoded->decodeStart = decodeStart;
+
+        return decoded;
     }
 
-    bool IsIdle()
+    // Runs on a worker thread. wx has no reduced-size decode and allocates the
+    // full-size image itself, so it is decoded in full and then resampled to the
+    // size the gallery draws it at, into a buffer from the pool; only the small
+    // copy is kept.
+    static std::shared_ptr<DecodedImage> DecodeWithWx(const ByteSource &bytes, const wxSize &cellPixels, BitmapScaling scaling, PixelBufferPool &pixelPool)
     {
-        return isIdle;
+        wxMemoryInputStream stream(bytes.Data(), bytes.Size());
+
+        auto decoded = std::make_shared<DecodedImage>();
+        decoded->decodeStart = std::chrono::steady_clock::now();
+        decoded->image = wxImage(stream);
+        decoded->decodedFor = cellPixels;
+        decoded->scaling = scaling;
+
+        if (!decoded->image.IsOk())
+        {
+            decoded->decodeEnd = std::chrono::steady_clock::now();
+            return decoded;
+        }
+
+        if (auto target = DownscaledSize(decoded->image.GetWidth(), decoded->image.GetHeight(), cellPixels, scaling))
+        {
+            decoded->pixels = pixelPool.Acquire(target->GetWidth(), target->GetHeight(), decoded->image.HasAlpha());
+            DownscaleInto(decoded->image, *decoded->pixels);
+
+            // the full-size decode goes now, on the worker
+            decoded->image = wxImage();
+            decoded->downscaled = true;
+        }
+
+        decoded->decodeEnd = std::chrono::steady_clock::now();
+        return decoded;
     }
 
-    void CancelAll(const std::function<void()> &done)
+    // Runs on a worker thread. Turns the full-size output of a decoder into
+    // what goes into the cell: downscaled into a smaller pooled buffer, or the
+    // buffer itself when it is drawn at full size. A decoder still writing into
+    // `full` needs it copied instead.
+    static void FitToCell(DecodedImage &decoded, const std::shared_ptr<PixelBuffer> &full, bool copy, PixelBufferPool &pixelPool)
     {
-        if (currentRequest.IsOk() && currentRequest.GetState() == wxWebRequest::State_Active)
+        const int width = full->GetWidth(), height = full->GetHeight();
+        const bool alpha = full->Alpha() != nullptr;
+
+        if (auto target = DownscaledSize(width, height, decoded.decodedFor, decoded.scaling))
         {
-            urlsToLoad = {};
-            nextBatch = {};
-            finishCallback = done;
-            currentRequest.Cancel();
+            decoded.pixels = pixelPool.Acquire(target->GetWidth(), target->GetHeight(), alpha);
+            DownscaleInto(full->Rgb(), full->Alpha(), width, height, *decoded.pixels);
+            decoded.downscaled = true;
+        }
+        else if (copy)
+        {
+            const size_t pixels = static_cast<size_t>(width) * height;
+
+            decoded.pixels = pixelPool.Acquire(width, height, alpha);
+            std::copy(full->Rgb(), full->Rgb() + pixels * 3, decoded.pixels->Rgb());
+
+            if (alpha)
+            {
+                std::copy(full->Alpha(), full->Alpha() + pixels, decoded.pixels->Alpha());
+            }
         }
         else
         {
-            done();
+            decoded.pixels = full;
         }
     }
 
-private:
-    void LoadNextBitmap()
+    // decoding runs on the worker pool; only the wxBitmap conversion and the
+    // hand-off to the gallery happen back on the GUI thread
+    void QueueDecode(const std::string &url, std::shared_ptr<const ByteSource> bytes)
     {
-        auto url = urlsToLoad.front();
-        urlsToLoad.pop();
+        const wxSize cellPixels = bitmapView->GetCellPixelSize();
+        const BitmapScaling scaling = bitmapView->scaling;
 
-        currentRequest = wxWebSession::GetDefault().CreateRequest(this, url);
+        decodePool.Submit([this, url, bytes, cellPixels, scaling]()
+                          {
+                              // wxImage reference counting is not thread-safe, so the image
+                              // itself is never copied across threads, only the shared_ptr
+                              auto decoded = Decode(*bytes, cellPixels, scaling, pixelPool);
 
-        currentRequest.Start();
+                              this->CallAfter([this, url, bytes, decoded]()
+                                              { OnImageDecoded(url, bytes, *decoded); }); });
     }
 
-    void OnWebRequestState(wxWebRequestEvent &event)
+    void OnImageDecoded(const std::string &url, std::shared_ptr<const ByteSource> bytes, const DecodedImage &decoded)
     {
-        bool shouldEnqueueNextBatch = nextBatch.size() > 0;
+        std::optional<RequestTrace> trace;
+        auto traced = pipelineTraces.find(url);
 
-        if (!shouldEnqueueNextBatch && event.GetState() == wxWebRequest::State_Completed)
+        if (traced != pipelineTraces.end())
         {
-            wxLogDebug(" -- Request finished. Adding bitmap: %s", event.GetResponse().GetURL());
+            trace = std::move(traced->second);
+            pipelineTraces.erase(traced);
+
+            // an image decoded while it downloads only counts the decoding
+            // left after the last byte
+            trace->decodeStart = std::max(decoded.decodeStart, trace->completed.value_or(decoded.decodeStart));
+            trace->decodeEnd = decoded.decodeEnd;
+        }
 
-            wxImage image = wxImage(*event.GetResponse().GetStream());
+        if (!scheduler.Contains(url))
+        {
+            wxLogDebug(" -- Dropping decoded image that is no longer wanted: %s", url);
 
-            if (image.IsOk())
+            if (trace)
             {
-                auto bitmap = wxBitmap(image);
-                bitmapView->bitmaps.push_back(bitmap);
-                bitmapView->Refresh();
+                Metrics::Get().Finish(*trace);
             }
+
+            return;
         }
 
-        if (event.GetState() != wxWebRequest::State_Active)
+        CompleteJob(url);
+
+        std::optional<wxBitmap> bitmap;
+
+        if (decoded.IsOk())
         {
-            if (shouldEnqueueNextBatch)
+            bitmap = decoded.ToBitmap();
+            cache.Put(url, {*bitmap, bytes, decoded.decodedFor, decoded.scaling, decoded.downscaled});
+
+            if (batchWanted.count(url) == 0)
             {
-                wxLogDebug(" -- Request state <%s> and next batch ready. Starting again.", state(event.GetState()));
+                prefetchedBytes += BitmapBytes(*bitmap);
+            }
+        }
+
+        if (trace)
+        {
+            trace->bitmapReady = std::chrono::steady_clock::now();
+        }
+
+        DeliverToSlots(url, bitmap);
+
+        // an image going into a cell is traced until the cell is first painted
+        if (trace && bitmap && std::find(batchUrls.begin(), batchUrls.end(), url) != batchUrls.end())
+        {
+            pipelineTraces[url] = std::move(*trace);
+        }
+        else if (trace)
+        {
+            Metrics::Get().Finish(*trace);
+        }
+
+        StartRequests();
+    }
+
+    void OnSlotPainted(size_t slot)
+    {
+        if (slot >= batchUrls.size())
+        {
+            return;
+        }
+
+        auto it = pipelineTraces.find(batchUrls[slot]);
 
-                isIdle = true;
+        // partial images are painted too, but only the final one has a bitmap ready
+        if (it == pipelineTraces.end() || !it->second.bitmapReady)
+        {
+            return;
+        }
+
+        it->second.firstPaint = std::chrono::steady_clock::now();
+        Metrics::Get().Finish(it->second);
+        pipelineTraces.erase(it);
+    }
+
+    void QueueRedecode(const std::string &url, std::shared_ptr<const ByteSource> bytes)
+    {
+        if (!bytes || !redecoding.insert(url).second)
+        {
+            return;
+        }
+
+        const wxSize cellPixels = bitmapView->GetCellPixelSize();
+        const BitmapScaling scaling = bitmapView->scaling;
+
+        decodePool.Submit([this, url, bytes, cellPixels, scaling]()
+                          {
+                              auto decoded = Decode(*bytes, cellPixels, scaling, pixelPool);
+
+                              this->CallAfter([this, url, bytes, decoded]()
+                                              { OnImageRedecoded(url, bytes, *decoded); }); });
+    }
+
+    void OnImageRedecoded(const std::string &url, std::shared_ptr<const ByteSource> bytes, const DecodedImage &decoded)
+    {
+        redecoding.erase(url);
+
+        if (!decoded.IsOk())
+        {
+            return;
+        }
+
+        wxBitmap bitmap = decoded.ToBitmap();
+        cache.Put(url, {bitmap, bytes, decoded.decodedFor, decoded.scaling, decoded.downscaled});
 
-                LoadBitmaps(nextBatch);
-                nextBatch.clear();
+        for (size_t slot = 0; slot < batchUrls.size(); slot++)
+        {
+            if (batchUrls[slot] == url && slotFinished[slot])
+            {
+                bitmapView->ReplaceBitmap(slot, bitmap);
             }
-            else
+        }
+    }
+
+    // Waits for the first bytes to tell the format. JPEG and PNG bodies whose
+    // image will be decoded are fed to a decoder from then on; a body only held
+    // in memory for that is let go.
+    void SniffBody(ActiveRequest &active, const unsigned char *data, size_t size)
+    {
+        const size_t taken = std::min(size, ProgressiveDecoder::SignatureBytes - active.head.size());
+        active.head.insert(active.head.end(), data, data + taken);
+
+        if (active.head.size() < ProgressiveDecoder::SignatureBytes)
+        {
+            return;
+        }
+
+        active.sniffed = true;
+
+        const bool inBatch = batchWanted.count(active.url) > 0;
+        const bool cached = httpCache && active.body && active.body->IsFile();
+        auto decoder = ProgressiveDecoder::Create(active.head.data(), active.head.size(), pixelPool);
+
+        if (decoder && (inBatch || decodePrefetched || !cached))
+        {
+            auto decode = std::make_shared<StreamingDecode>();
+            decode->decoder = std::move(decoder);
+            decode->previews = inBatch && active.url != thumbnailUrl;
+            decode->cellPixels = bitmapView->GetCellPixelSize();
+            decode->scaling = bitmapView->scaling;
+
+            active.decode = decode;
+            FeedStreamingDecode(active.url, decode, active.head.data(), active.head.size());
+            FeedStreamingDecode(active.url, decode, data + taken, size - taken);
+
+            if (!cached)
             {
-                wxLogDebug(" -- Request state <%s> and no next batch ready. Checking if more URLs to load.", state(event.GetState()));
+                active.body.reset();
+            }
+        }
 
-                if (urlsToLoad.empty())
-                {
-                    wxLogDebug(" -- Request state <%s> and no more URLs to load. Finishing && setting to Idle", state(event.GetState()));
-                    isIdle = true;
+        active.head = {};
+    }
+
+    void FeedStreamingDecode(const std::string &url, const std::shared_ptr<StreamingDecode> &decode, const unsigned char *data, size_t size)
+    {
+        if (size == 0 || decode->abandoned)
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(decode->mutex);
+            decode->chunks.emplace_back(data, data + size);
+
+            if (decode->draining)
+            {
+                return;
+            }
+
+            decode->draining = true;
+        }
+
+        decodePool.Submit([this, url, decode]()
+                          { DrainStreamingDecode(url, decode); });
+    }
+
+    // `source` is the complete body if it was kept, for wx to fall back on
+    void FinishStreamingDecode(const std::string &url, const std::shared_ptr<StreamingDecode> &decode, std::shared_ptr<const ByteSource> source)
+    {
+        {
+            std::lock_guard<std::mutex> lock(decode->mutex);
+            decode->ended = true;
+            decode->source = std::move(source);
+            decode->cellPixels = bitmapView->GetCellPixelSize();
+            decode->scaling = bitmapView->scaling;
+
+            if (decode->draining)
+            {
+                return;
+            }
+
+            decode->draining = true;
+        }
+
+        decodePool.Submit([this, url, decode]()
+                          { DrainStreamingDecode(url, decode); });
+    }
+
+    // Runs on a worker thread: feeds the queued chunks to the decoder, showing
+    // what it has so far now and then, and hands over the final image once
+    // the body has ended.
+    void DrainStreamingDecode(const std::string &url, const std::shared_ptr<StreamingDecode> &decode)
+    {
+        for (;;)
+        {
+            std::vector<unsigned char> chunk;
 
-                    if (finishCallback)
+            {
+                std::lock_guard<std::mutex> lock(decode->mutex);
+
+                if (decode->chunks.empty())
+                {
+                    if (!decode->ended)
                     {
-                        finishCallback();
+                        decode->draining = false;
+                        return;
                     }
+
+                    break;
                 }
-                else
-                {
-                    wxLogDebug(" -- Request state <%s> and more URLs to load. Loading next.", state(event.GetState()));
-                    LoadNextBitmap();
-                }
+
+                chunk = std::move(decode->chunks.front());
+                decode->chunks.pop_front();
+            }
+
+            if (decode->abandoned)
+            {
+                decode->decoder.reset();
+                continue;
+            }
+
+            if (decode->decodeStart == std::chrono::steady_clock::time_point())
+            {
+                decode->decodeStart = std::chrono::steady_clock::now();
+            }
+
+            if (decode->decoder->Feed(chunk.data(), chunk.size()) && !decode->decoder->IsComplete())
+            {
+                MakePreview(url, decode);
+            }
+        }
+
+        if (decode->abandoned)
+        {
+            decode->decoder.reset();
+            return;
+        }
+
+        std::shared_ptr<const ByteSource> source;
+        auto decoded = std::make_shared<DecodedImage>();
+
+        {
+            std::lock_guard<std::mutex> lock(decode->mutex);
+            source = decode->source;
+            decoded->decodedFor = decode->cellPixels;
+            decoded->scaling = decode->scaling;
+        }
+
+        if (decode->decoder->IsComplete())
+        {
+            decoded->decodeStart = decode->decodeStart;
+            FitToCell(*decoded, decode->decoder->GetPixels(), false, *pixelPool);
+            decoded->decodeEnd = std::chrono::steady_clock::now();
+        }
+        else if (source)
+        {
+            // broken or cut short for the decoder; wx may still make something of it
+            decoded = DecodeWithWx(*source, decoded->decodedFor, decoded->scaling, *pixelPool);
+        }
+        else
+        {
+            decoded->decodeStart = decoded->decodeEnd = std::chrono::steady_clock::now();
+        }
+
+        decode->decoder.reset();
+
+        this->CallAfter([this, url, source, decoded]()
+                        { OnImageDecoded(url, source, *decoded); });
+    }
+
+    // Runs on a worker thread, between chunks. Throttled, and never more than
+    // one partial image in flight, so previews do not pile up behind a busy
+    // GUI thread.
+    void MakePreview(const std::string &url, const std::shared_ptr<StreamingDecode> &decode)
+    {
+        const ProgressiveDecoder &decoder = *decode->decoder;
+        const auto now = std::chrono::steady_clock::now();
+
+        if (!decode->previews || !decoder.GetPixels() || decoder.GetRowsWritten() == decode->previewRows || decode->previewPending ||
+            now - decode->lastPreview < std::chrono::milliseconds(PartialDecodeIntervalMs))
+        {
+            return;
+        }
+
+        decode->previewRows = decoder.GetRowsWritten();
+        decode->lastPreview = now;
+        decode->previewPending = true;
+
+        auto decoded = std::make_shared<DecodedImage>();
+
+        {
+            std::lock_guard<std::mutex> lock(decode->mutex);
+            decoded->decodedFor = decode->cellPixels;
+            decoded->scaling = decode->scaling;
+        }
+
+        FitToCell(*decoded, decoder.GetPixels(), true, *pixelPool);
+
+        this->CallAfter([this, url, decode, decoded]()
+                        { OnPartialDecoded(url, *decode, *decoded); });
+    }
+
+    // shown in the cell but not cached; the complete image replaces it
+    void OnPartialDecoded(const std::string &url, StreamingDecode &decode, const DecodedImage &decoded)
+    {
+        decode.previewPending = false;
+
+        if (decode.abandoned)
+        {
+            return;
+        }
+
+        const wxBitmap bitmap = decoded.ToBitmap();
+
+        for (size_t slot = 0; slot < batchUrls.size(); slot++)
+        {
+            if (batchUrls[slot] == url && !slotFinished[slot])
+            {
+                bitmapView->ReplaceBitmap(slot, bitmap);
+                NoteImageShown();
+            }
+        }
+    }
+
+    void OnGallerySize(wxSizeEvent &event)
+    {
+        event.Skip();
+
+        // re-deriving on every step of a drag-resize would flood the workers
+        resizeTimer.StartOnce(ResizeSettleMs);
+    }
+
+    void OnResizeSettled(wxTimerEvent &event)
+    {
+        const wxSize cellPixels = bitmapView->GetCellPixelSize();
+
+        for (const auto &url : batchUrls)
+        {
+            const CachedBitmap *cached = cache.Peek(url);
+
+            if (cached && cached->NeedsRedecode(cellPixels, bitmapView->scaling))
+            {
+                QueueRedecode(url, cached->source);
             }
         }
     }
 
+    void NotifyIfFinished()
+    {
+        if (!IsIdle() || !finishCallback)
+        {
+            return;
+        }
+
+        auto callback = std::move(finishCallback);
+        finishCallback = nullptr;
+        callback();
+    }
+
+    void LogStats() const
+    {
+        const auto cacheStats = cache.GetStats();
+        wxLogDebug(" -- Batch complete (cache: %zu hits, %zu misses, %zu evictions, %zu/%zu bytes)",
+                   cacheStats.hits, cacheStats.misses, cacheStats.evictions, cacheStats.bytes, cacheStats.budgetBytes);
+
+        const auto schedulerStats = scheduler.GetStats();
+        wxLogDebug("    %zu requests coalesced into downloads already running", schedulerStats.coalesced);
+        static const char *names[RequestPriorityCount] = {"visible", "current", "prefetch"};
+
+        for (size_t i = 0; i < RequestPriorityCount; i++)
+        {
+            const auto &priority = schedulerStats.priorities[i];
+            wxLogDebug("    %-8s queued %zu, in flight %zu, completed %zu, latency mean %.1f ms, max %.1f ms",
+                       names[i], priority.queued, priority.inFlight, priority.completed, priority.MeanLatencyMs(), priority.maxLatencyMs);
+        }
+    }
+
     static std::string state(wxWebRequest::State state)
     {
         switch (state)
@@ -150,13 +1327,49 @@ private:
         }
     }
 
-    std::queue<std::string> urlsToLoad;
-
     BitmapGallery *bitmapView;
-    wxWebRequest currentRequest;
+    HttpCache *httpCache;
+
+    std::vector<std::string> batchUrls;
+    std::set<std::string> batchWanted;
+
+    // slot i is gallery cell i
+    std::vector<bool> slotFinished;
+    std::vector<std::optional<RequestPriority>> slotClaims;
+    bool batchLogged = false;
 
-    std::vector<std::string> nextBatch;
-    bool isIdle = true;
+    std::string thumbnailUrl;
+    std::optional<RequestPriority> thumbnailClaim;
+
+    LoadStats loadStats;
+    std::chrono::steady_clock::time_point batchStart;
+    std::optional<std::chrono::steady_clock::time_point> batchFirstImage;
+    std::function<void(const BatchTiming &)> onBatchComplete;
+
+    BitmapCache cache;
+    RequestScheduler scheduler;
+    std::map<int, ActiveRequest> activeRequests;
+
+    // when each URL was first claimed, until its request starts
+    std::map<std::string, std::chrono::steady_clock::time_point> queuedAt;
+
+    // downloaded images being decoded or waiting to be painted
+    std::map<std::string, RequestTrace> pipelineTraces;
+
+    std::vector<std::string> prefetchClaims;
+    size_t prefetchedBytes = 0;
+    size_t prefetchBudgetBytes = DefaultCacheBudgetBytes / 2;
+    bool decodePrefetched = true;
+
+    std::set<std::string> redecoding;
+    wxTimer resizeTimer;
 
     std::function<void()> finishCallback;
-};
\ No newline at end of file
+
+    // shared with the buffers it hands out, which may outlive the loader in
+    // results still queued for the GUI thread
+    std::shared_ptr<PixelBufferPool> pixelPool = std::make_shared<PixelBufferPool>();
+
+    // declared last so the workers are joined before anything they post back to
+    WorkerPool decodePool;
+};
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <wx/msw/wrapwin.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a response body, either owned in memory or mapped from disk.
+// Instances are immutable once built, so they can be shared with worker threads.
+class ByteSource
+{
+public:
+    virtual ~ByteSource() = default;
+
+    virtual const unsigned char *Data() const = 0;
+    virtual size_t Size() const = 0;
+
+    // bytes this source keeps on the heap; mapped files live in the page cache
+    virtual size_t HeapBytes() const
+    {
+        return Size();
+    }
+};
+
+class MemoryBytes : public ByteSource
+{
+public:
+    MemoryBytes(std::vector<unsigned char> bytes) : bytes(std::move(bytes)) {}
+
+    const unsigned char *Data() const override
+    {
+        return bytes.data();
+    }
+
+    size_t Size() const override
+    {
+        return bytes.size();
+    }
+
+private:
+    std::vector<unsigned char> bytes;
+};
+
+class MappedFile : public ByteSource
+{
+public:
+    // returns nullptr if the file cannot be opened or mapped
+    static std::shared_ptr<MappedFile> Open(const std::string &path)
+    {
+        auto file = std::shared_ptr<MappedFile>(new MappedFile());
+
+        if (!file->Map(path))
+        {
+            return nullptr;
+        }
+
+        return file;
+    }
+
+    ~MappedFile()
+    {
+        Unmap();
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *Data() const override
+    {
+        return data;
+    }
+
+    size_t Size() const override
+    {
+        return size;
+    }
+
+    size_t HeapBytes() const override
+    {
+        return 0;
+    }
+
+private:
+    MappedFile() = default;
+
+#ifdef _WIN32
+    bool Map(const std::string &path)
+    {
+        const int wideLength = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+        std::wstring widePath(wideLength, L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, widePath.data(), wideLength);
+
+        HANDLE file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        size = static_cast<size_t>(fileSize.QuadPart);
+
+        if (size == 0)
+        {
+            CloseHandle(file);
+            return true;
+        }
+
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+
+        if (!mapping)
+        {
+            return false;
+        }
+
+        data = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+        return data != nullptr;
+    }
+
+    void Unmap()
+    {
+        if (data)
+        {
+            UnmapViewOfFile(data);
+        }
+
+        if (mapping)
+        {
+            CloseHandle(mapping);
+        }
+    }
+
+    HANDLE mapping = nullptr;
+#else
+    bool Map(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        size = static_cast<size_t>(info.st_size);
+
+        if (size == 0)
+        {
+            close(fd);
+            return true;
+        }
+
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+
+        data = static_cast<const unsigned char *>(mapped);
+
+        return true;
+    }
+
+    void Unmap()
+    {
+        if (data)
+        {
+            munmap(const_cast<unsigned char *>(data), size);
+        }
+    }
+#endif
+
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+};
+
+// A body handed from the thread receiving it to a reader on another thread
+// while it arrives. The receiver pushes chunks; the reader wraps this in a
+// std::istream and blocks until the next chunk is in or the stream is closed.
+// Closing it as incomplete ends the input right away, so a parser reading it
+// fails instead of waiting for bytes that will never come.
+class ChunkStream : public std::streambuf
+{
+public:
+    void Push(const void *data, size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+
+        const char *bytes = static_cast<const char *>(data);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chunks.emplace_back(bytes, bytes + size);
+        }
+
+        arrived.notify_one();
+    }
+
+    // no more chunks; `complete` is false when the body was cut short
+    void Close(bool complete)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+
+            if (!complete)
+            {
+                failed = true;
+                chunks.clear();
+            }
+        }
+
+        arrived.notify_one();
+    }
+
+    bool Failed() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failed;
+    }
+
+protected:
+    int_type underflow() override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        arrived.wait(lock, [this]()
+                     { return closed || !chunks.empty(); });
+
+        if (failed || chunks.empty())
+        {
+            return traits_type::eof();
+        }
+
+        current = std::move(chunks.front());
+        chunks.pop_front();
+        setg(current.data(), current.data(), current.data() + current.size());
+
+        return traits_type::to_int_type(current.front());
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable arrived;
+    std::deque<std::vector<char>> chunks;
+    bool closed = false, failed = false;
+
+    // the chunk the reader is in; only touched by the reader
+    std::vector<char> current;
+};
@@ -0,0 +1,565 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "catalogstore.h"
+
+// A parsed catalog query: clauses joined by AND, e.g.
+//
+//     category=laptops AND price<1000 AND text:ssd
+//
+// Supported clauses are brand=<name> and category=<name> (case-insensitive,
+// quote names containing spaces), price/rating compared with < <= > >= =, and
+// text:<word> matching whole words in the title or description. A bare word is
+// shorthand for text:<word>, and clauses next to each other without AND are
+// joined by AND all the same.
+struct CatalogQuery
+{
+    enum class Field
+    {
+        Brand,
+        Category,
+        Price,
+        Rating,
+        Text
+    };
+
+    enum class Comparison
+    {
+        Equal,
+        Less,
+        LessOrEqual,
+        Greater,
+        GreaterOrEqual
+    };
+
+    struct Clause
+    {
+        Field field;
+        Comparison comparison = Comparison::Equal;
+        std::string text;
+        double number = 0;
+    };
+
+    std::vector<Clause> clauses;
+
+    bool Empty() const
+    {
+        return clauses.empty();
+    }
+
+    // returns nullopt and describes the problem in `error` if the text does not parse
+    static std::optional<CatalogQuery> Parse(std::string_view input, std::string *error = nullptr)
+    {
+        CatalogQuery query;
+        size_t pos = 0;
+
+        auto fail = [&](const std::string &message) -> std::optional<CatalogQuery>
+        {
+            if (error)
+            {
+                *error = message;
+            }
+
+            return std::nullopt;
+        };
+
+        while (true)
+        {
+            SkipSpaces(input, pos);
+
+            if (pos >= input.size())
+            {
+                break;
+            }
+
+            // AND between clauses is optional: "usb cable" is two text clauses
+            if (!query.clauses.empty())
+            {
+                size_t next = pos;
+
+                if (Lowercase(ReadWord(input, next)) == "and")
+                {
+                    pos = next;
+                    SkipSpaces(input, pos);
+                }
+            }
+
+            const std::string name = Lowercase(ReadWord(input, pos));
+
+            if (name.empty())
+            {
+                return fail("expected a condition at position " + std::to_string(pos));
+            }
+
+            Clause clause;
+
+            if (pos < input.size() && input[pos] == ':')
+            {
+                pos++;
+
+                if (name != "text")
+                {
+                    return fail("unknown field \"" + name + ":\"");
+                }
+
+                clause.field = Field::Text;
+                clause.text = ReadValue(input, pos);
+            }
+            else if (pos < input.size() && (input[pos] == '=' || input[pos] == '<' || input[pos] == '>'))
+            {
+                clause.comparison = ReadComparison(input, pos);
+                const std::string value = ReadValue(input, pos);
+
+                if (name == "brand" || name == "category")
+                {
+                    if (clause.comparison != Comparison::Equal)
+                    {
+                        return fail(name + " only supports =");
+                    }
+
+                    clause.field = name == "brand" ? Field::Brand : Field::Category;
+                    clause.text = Lowercase(value);
+                }
+                else if (name == "price" || name == "rating")
+                {
+                    char *end = nullptr;
+                    clause.number = std::strtod(value.c_str(), &end);
+
+                    if (value.empty() || *end != '\0')
+                    {
+                        return fail("\"" + value + "\" is not a number");
+                    }
+
+                    clause.field = name == "price" ? Field::Price : Field::Rating;
+                }
+                else
+                {
+                    return fail("unknown field \"" + name + "\"");
+                }
+            }
+            else
+            {
+                clause.field = Field::Text;
+                clause.text = name;
+            }
+
+            if (clause.field != Field::Text)
+            {
+                query.clauses.push_back(std::move(clause));
+                continue;
+            }
+
+            // "usb cable" means both words, the way the index splits text
+            std::vector<std::string> words;
+            Tokenize(clause.text, words);
+
+            if (words.empty())
+            {
+                return fail("empty text condition");
+            }
+
+            for (auto &word : words)
+            {
+                query.clauses.push_back({Field::Text, Comparison::Equal, std::move(word)});
+            }
+        }
+
+        return query;
+    }
+
+    // lowercase runs of letters and digits; single characters are not worth indexing
+    static void Tokenize(std::string_view text, std::vector<std::string> &words)
+    {
+        size_t pos = 0;
+
+        while (pos < text.size())
+        {
+            while (pos < text.size() && !std::isalnum(static_cast<unsigned char>(text[pos])))
+            {
+                pos++;
+            }
+
+            const size_t start = pos;
+
+            while (pos < text.size() && std::isalnum(static_cast<unsigned char>(text[pos])))
+            {
+                pos++;
+            }
+
+            if (pos - start >= 2)
+            {
+                words.push_back(Lowercase(text.substr(start, pos - start)));
+            }
+        }
+    }
+
+    static std::string Lowercase(std::string_view text)
+    {
+        std::string result(text);
+
+        for (auto &c : result)
+        {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+
+        return result;
+    }
+
+private:
+    static void SkipSpaces(std::string_view input, size_t &pos)
+    {
+        while (pos < input.size() && std::isspace(static_cast<unsigned char>(input[pos])))
+        {
+            pos++;
+        }
+    }
+
+    static std::string ReadWord(std::string_view input, size_t &pos)
+    {
+        const size_t start = pos;
+
+        while (pos < input.size() && !std::isspace(static_cast<unsigned char>(input[pos])) && input[pos] != ':' && input[pos] != '=' && input[pos] != '<' && input[pos] != '>')
+        {
+            pos++;
+        }
+
+        return std::string(input.substr(start, pos - start));
+    }
+
+    static std::string ReadValue(std::string_view input, size_t &pos)
+    {
+        if (pos < input.size() && input[pos] == '"')
+        {
+            const size_t end = input.find('"', pos + 1);
+            const size_t close = end == std::string_view::npos ? input.size() : end;
+
+            std::string value(input.substr(pos + 1, close - pos - 1));
+            pos = std::min(input.size(), close + 1);
+
+            return value;
+        }
+
+        const size_t start = pos;
+
+        while (pos < input.size() && !std::isspace(static_cast<unsigned char>(input[pos])))
+        {
+            pos++;
+        }
+
+        return std::string(input.substr(start, pos - start));
+    }
+
+    static Comparison ReadComparison(std::string_view input, size_t &pos)
+    {
+        const char first = input[pos++];
+        const bool orEqual = pos < input.size() && input[pos] == '=';
+
+        if (orEqual)
+        {
+            pos++;
+        }
+
+        if (first == '<')
+            return orEqual ? Comparison::LessOrEqual : Comparison::Less;
+
+        if (first == '>')
+            return orEqual ? Comparison::GreaterOrEqual : Comparison::Greater;
+
+        return Comparison::Equal;
+    }
+};
+
+// Search indexes over a CatalogStore, extended incrementally as products are
+// appended:
+//
+//  - an inverted index from lowercase title/description words to product ids,
+//  - facet lists of product ids per brand and per category,
+//  - product ids sorted by price and by rating.
+//
+// Every id list except the sorted ones is in catalog order, so clauses combine
+// by linear intersection and results come out in catalog order.
+class CatalogIndex
+{
+public:
+    using Ids = std::vector<uint32_t>;
+
+    // Indexes the products appended to the store since the last call, or only
+    // the next `limit` of them, so a large store can be indexed in slices
+    // between events. Queries see the products indexed so far.
+    void Update(const CatalogStore &store, size_t limit = SIZE_MAX)
+    {
+        const size_t first = indexedCount;
+        const size_t count = store.Size() - first > limit ? first + limit : store.Size();
+
+        if (first >= count)
+        {
+            return;
+        }
+
+        for (size_t id = labelKeys.size(); id < store.LabelCount(); id++)
+        {
+            labelKeys.push_back(CatalogQuery::Lowercase(store.Label(static_cast<uint32_t>(id))));
+            labelIds[labelKeys.back()].push_back(static_cast<uint32_t>(id));
+        }
+
+        brandFacets.resize(store.LabelCount());
+        categoryFacets.resize(store.LabelCount());
+
+        std::vector<std::string> words;
+
+        for (size_t i = first; i < count; i++)
+        {
+            const uint32_t id = static_cast<uint32_t>(i);
+
+            brandFacets[store.BrandIds()[i]].push_back(id);
+            categoryFacets[store.CategoryIds()[i]].push_back(id);
+
+            words.clear();
+            CatalogQuery::Tokenize(store.Title(i), words);
+            CatalogQuery::Tokenize(store.Description(i), words);
+
+            std::sort(words.begin(), words.end());
+            words.erase(std::unique(words.begin(), words.end()), words.end());
+
+            for (const auto &word : words)
+            {
+                postings[word].push_back(id);
+            }
+        }
+
+        AppendSorted(byPrice, first, count, store.Prices());
+        AppendSorted(byRating, first, count, store.Ratings());
+
+        indexedCount = count;
+    }
+
+    size_t Size() const
+    {
+        return indexedCount;
+    }
+
+    // ids of the matching products, in catalog order
+    Ids Run(const CatalogQuery &query, const CatalogStore &store) const
+    {
+        std::vector<const CatalogQuery::Clause *> ranges;
+        std::optional<Ids> result;
+
+        auto intersect = [&result](Ids ids)
+        {
+            if (!result)
+            {
+                result = std::move(ids);
+                return;
+            }
+
+            Ids both;
+            std::set_intersection(result->begin(), result->end(), ids.begin(), ids.end(), std::back_inserter(both));
+            result = std::move(both);
+        };
+
+        // set clauses first: they are cheap lists to intersect
+        for (const auto &clause : query.clauses)
+        {
+            switch (clause.field)
+            {
+            case CatalogQuery::Field::Brand:
+                intersect(FacetIds(brandFacets, clause.text));
+                break;
+            case CatalogQuery::Field::Category:
+                intersect(FacetIds(categoryFacets, clause.text));
+                break;
+            case CatalogQuery::Field::Text:
+            {
+                auto it = postings.find(clause.text);
+                intersect(it == postings.end() ? Ids() : it->second);
+                break;
+            }
+            default:
+                ranges.push_back(&clause);
+                break;
+            }
+
+            if (result && result->empty())
+            {
+                return {};
+            }
+        }
+
+        // without a set clause, start from the most selective range in its sorted index
+        if (!result && !ranges.empty())
+        {
+            auto narrowest = std::min_element(ranges.begin(), ranges.end(), [&](const auto *a, const auto *b)
+                                              { return RangeSize(*a, store) < RangeSize(*b, store); });
+
+            result = RangeIds(**narrowest, store);
+            ranges.erase(narrowest);
+        }
+
+        if (!result)
+        {
+            result = Ids(indexedCount);
+
+            for (size_t i = 0; i < indexedCount; i++)
+            {
+                (*result)[i] = static_cast<uint32_t>(i);
+            }
+        }
+
+        // remaining ranges are checked against the columns directly
+        for (const auto *clause : ranges)
+        {
+            result->erase(std::remove_if(result->begin(), result->end(), [&](uint32_t id)
+                                         { return !Matches(*clause, ColumnValue(*clause, store, id), Bound(*clause)); }),
+                          result->end());
+        }
+
+        return std::move(*result);
+    }
+
+private:
+    // new ids are sorted on their own and merged in, so each page costs O(n)
+    template <typename T>
+    static void AppendSorted(Ids &sorted, size_t first, size_t count, const std::vector<T> &values)
+    {
+        const size_t oldSize = sorted.size();
+
+        for (size_t i = first; i < count; i++)
+        {
+            sorted.push_back(static_cast<uint32_t>(i));
+        }
+
+        auto byValue = [&values](uint32_t a, uint32_t b)
+        { return values[a] < values[b] || (values[a] == values[b] && a < b); };
+
+        std::sort(sorted.begin() + oldSize, sorted.end(), byValue);
+        std::inplace_merge(sorted.begin(), sorted.begin() + oldSize, sorted.end(), byValue);
+    }
+
+    Ids FacetIds(const std::vector<Ids> &facets, const std::string &key) const
+    {
+        auto it = labelIds.find(key);
+
+        if (it == labelIds.end())
+        {
+            return {};
+        }
+
+        // labels differing only in case share a key
+        Ids ids;
+
+        for (uint32_t labelId : it->second)
+        {
+            if (labelId < facets.size())
+            {
+                Ids merged;
+                std::merge(ids.begin(), ids.end(), facets[labelId].begin(), facets[labelId].end(), std::back_inserter(merged));
+                ids = std::move(merged);
+            }
+        }
+
+        return ids;
+    }
+
+    const Ids &SortedIndex(const CatalogQuery::Clause &clause) const
+    {
+        return clause.field == CatalogQuery::Field::Price ? byPrice : byRating;
+    }
+
+    static double ColumnValue(const CatalogQuery::Clause &clause, const CatalogStore &store, uint32_t id)
+    {
+        return clause.field == CatalogQuery::Field::Price ? store.Prices()[id] : store.Ratings()[id];
+    }
+
+    // ratings are stored as float; compare in the column's own precision
+    static double Bound(const CatalogQuery::Clause &clause)
+    {
+        return clause.field == CatalogQuery::Field::Rating ? static_cast<float>(clause.number) : clause.number;
+    }
+
+    static bool Matches(const CatalogQuery::Clause &clause, double value, double bound)
+    {
+        switch (clause.comparison)
+        {
+        case CatalogQuery::Comparison::Less:
+            return value < bound;
+        case CatalogQuery::Comparison::LessOrEqual:
+            return value <= bound;
+        case CatalogQuery::Comparison::Greater:
+            return value > bound;
+        case CatalogQuery::Comparison::GreaterOrEqual:
+            return value >= bound;
+        case CatalogQuery::Comparison::Equal:
+            return value == bound;
+        }
+
+        return false;
+    }
+
+    // the matching slice of the sorted index, found by binary search
+    std::pair<Ids::const_iterator, Ids::const_iterator> Range(const CatalogQuery::Clause &clause, const CatalogStore &store) const
+    {
+        const Ids &sorted = SortedIndex(clause);
+
+        const double bound = Bound(clause);
+
+        auto below = [&](uint32_t id, double value)
+        { return ColumnValue(clause, store, id) < value; };
+        auto notAbove = [&](uint32_t id, double value)
+        { return ColumnValue(clause, store, id) <= value; };
+
+        const auto lower = std::lower_bound(sorted.begin(), sorted.end(), bound, below);
+        const auto upper = std::lower_bound(sorted.begin(), sorted.end(), bound, notAbove);
+
+        switch (clause.comparison)
+        {
+        case CatalogQuery::Comparison::Less:
+            return {sorted.begin(), lower};
+        case CatalogQuery::Comparison::LessOrEqual:
+            return {sorted.begin(), upper};
+        case CatalogQuery::Comparison::Greater:
+            return {upper, sorted.end()};
+        case CatalogQuery::Comparison::GreaterOrEqual:
+            return {lower, sorted.end()};
+        case CatalogQuery::Comparison::Equal:
+            return {lower, upper};
+        }
+
+        return {sorted.end(), sorted.end()};
+    }
+
+    size_t RangeSize(const CatalogQuery::Clause &clause, const CatalogStore &store) const
+    {
+        const auto [begin, end] = Range(clause, store);
+        return end - begin;
+    }
+
+    Ids RangeIds(const CatalogQuery::Clause &clause, const CatalogStore &store) const
+    {
+        const auto [begin, end] = Range(clause, store);
+
+        Ids ids(begin, end);
+        std::sort(ids.begin(), ids.end());
+
+        return ids;
+    }
+
+    size_t indexedCount = 0;
+
+    std::unordered_map<std::string, Ids> postings;
+
+    // lowercase label -> label ids; brands and categories share the store's id space
+    std::vector<std::string> labelKeys;
+    std::unordered_map<std::string, std::vector<uint32_t>> labelIds;
+
+    std::vector<Ids> brandFacets, categoryFacets;
+    Ids byPrice, byRating;
+};
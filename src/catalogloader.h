@@ -0,0 +1,547 @@
+#pragma once
+
+#include <wx/wx.h>
+#include <wx/webrequest.h>
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <istream>
+#include <limits>
+
+#include "product.h"
+#include "productparser.h"
+#include "httpcache.h"
+#include "metrics.h"
+#include "workerpool.h"
+
+// Loads the product catalog one page at a time (limit/skip/total).
+//
+// Pages are only requested while the user is within LoadAheadDistance products of
+// the end of what has been loaded, and at most maxOutstanding pages are
+// downloading or parsing at once. Each page is parsed on a worker with the
+// streaming parser, fed the response chunks as they arrive (or the cached body
+// on a 304); products are handed to the owner strictly in catalog order, even
+// when pages finish out of order, and the first product of a page goes out as
+// soon as it is parsed. Page requests are traced into Metrics as "catalog.*",
+// with parsing in place of decoding.
+//
+// A failed page is retried on the next LoadAheadOf (not when another page
+// loads), and on a timer that backs off from InitialRetryDelayMs to
+// MaxRetryDelayMs, so a failure with nothing left to navigate to (the first
+// page, the last loaded product) does not stall the catalog. The user hears
+// about a failure once, until a page loads again.
+class CatalogLoader : public wxEvtHandler
+{
+public:
+    static constexpr auto DefaultBaseUrl = "https://dummyjson.com/products";
+    static constexpr size_t DefaultPageSize = 30;
+    static constexpr size_t DefaultMaxOutstanding = 2;
+    static constexpr size_t LoadAheadDistance = 10;
+    static constexpr int InitialRetryDelayMs = 500;
+    static constexpr int MaxRetryDelayMs = 30000;
+
+    // products streamed out of a page are handed over in batches of this size
+    static constexpr size_t ProductBatchSize = 64;
+
+    using ProductsCallback = std::function<void(std::vector<Product> &&products)>;
+
+    CatalogLoader(HttpCache *httpCache, ProductsCallback onProducts, const std::string &baseUrl = DefaultBaseUrl, size_t pageSize = DefaultPageSize, size_t maxOutstanding = DefaultMaxOutstanding)
+        : httpCache(httpCache), onProducts(std::move(onProducts)), baseUrl(baseUrl), pageSize(std::max<size_t>(1, pageSize)), maxOutstanding(std::max<size_t>(1, maxOutstanding)), parsePool(this->maxOutstanding)
+    {
+        this->Bind(wxEVT_WEBREQUEST_STATE, &CatalogLoader::OnWebRequestState, this);
+        this->Bind(wxEVT_WEBREQUEST_DATA, &CatalogLoader::OnWebRequestData, this);
+
+        retryTimer.SetOwner(this);
+        this->Bind(wxEVT_TIMER, [this](wxTimerEvent &)
+                   { LoadAheadOf(position); });
+    }
+
+    ~CatalogLoader()
+    {
+        // a parse waiting for more of its page would keep the pool from joining
+        for (auto &[id, active] : activeRequests)
+        {
+            if (active.stream)
+            {
+                active.stream->Close(false);
+            }
+        }
+    }
+
+    // Call whenever the current product changes; requests more pages when the
+    // user gets close to the end of the loaded products.
+    void LoadAheadOf(size_t index)
+    {
+        position = index;
+        RequestPages(true);
+    }
+
+    std::optional<size_t> GetTotal() const
+    {
+        return total;
+    }
+
+    bool IsIdle() const
+    {
+        return activeRequests.empty();
+    }
+
+    void CancelAll(const std::function<void()> &done)
+    {
+        retryTimer.Stop();
+
+        for (auto &[id, active] : activeRequests)
+        {
+            if (active.request.GetState() == wxWebRequest::State_Active)
+            {
+                active.request.Cancel();
+            }
+        }
+
+        if (!activeRequests.empty())
+        {
+            finishCallback = done;
+        }
+        else
+        {
+            done();
+        }
+    }
+
+private:
+    struct Page
+    {
+        std::vector<Product> buffered;
+
+        bool parsed = false;
+        bool failed = false;
+
+        // products of this page already parsed, skipped when a failed page is retried
+        size_t received = 0;
+        size_t toSkip = 0;
+
+        // of the last request, finished once its parse is
+        RequestTrace trace;
+    };
+
+    struct ActiveRequest
+    {
+        wxWebRequest request;
+        std::string url;
+        size_t skip;
+        RequestTrace trace;
+        bool repeated = false; // once, after a 304 the cache had no body for
+
+        // the body on its way into the cache, and to the parser once a 200 starts
+        std::shared_ptr<StreamedBody> body;
+        std::shared_ptr<ChunkStream> stream;
+        size_t receivedBytes = 0;
+    };
+
+    std::string PageUrl(size_t skip) const
+    {
+        return baseUrl + "?limit=" + std::to_string(pageSize) + "&skip=" + std::to_string(skip);
+    }
+
+    size_t OutstandingCount() const
+    {
+        return std::count_if(pages.begin(), pages.end(), [](const auto &entry)
+                             { return !entry.second.parsed; });
+    }
+
+    // Failed pages are only retried from LoadAheadOf (the user or the retry
+    // timer), never because some other page came in, so the backoff holds.
+    void RequestPages(bool retryFailed)
+    {
+        while (OutstandingCount() < maxOutstanding && RequestNextPage(retryFailed))
+        {
+        }
+    }
+
+    // returns false if no page could be requested right now
+    bool RequestNextPage(bool retryFailed)
+    {
+        // failed pages hold up everything after them, so they go first
+        for (auto &[skip, page] : pages)
+        {
+            if (page.failed && retryFailed)
+            {
+                page.failed = false;
+                page.parsed = false;
+                page.toSkip = page.received;
+
+                return StartPage(skip);
+            }
+        }
+
+        // without the total from the first page there is no telling whether more exist
+        if (!total && nextSkip > 0)
+        {
+            return false;
+        }
+
+        if (total && nextSkip >= *total)
+        {
+            return false;
+        }
+
+        // far enough ahead of the user for now
+        if (nextSkip > position + LoadAheadDistance)
+        {
+            return false;
+        }
+
+        const size_t skip = nextSkip;
+        nextSkip += pageSize;
+
+        pages[skip] = Page();
+        return StartPage(skip);
+    }
+
+    bool StartPage(size_t skip, bool repeat = false)
+    {
+        const std::string url = PageUrl(skip);
+        auto request = wxWebSession::GetDefault().CreateRequest(this, url);
+
+        if (!request.IsOk())
+        {
+            wxLogDebug("Catalog: failed to create request for %s", url);
+            pages[skip].parsed = true;
+            pages[skip].failed = true;
+            ScheduleRetry();
+            return false;
+        }
+
+        if (httpCache)
+        {
+            httpCache->PrepareRequest(request, url);
+        }
+
+        // the body comes in as data events, to be parsed while it downloads
+        request.SetStorage(wxWebRequest::Storage_None);
+
+        wxLogDebug("Catalog: requesting %s", url);
+
+        RequestTrace trace;
+        trace.kind = "catalog";
+        trace.url = url;
+        trace.queued = std::chrono::steady_clock::now();
+        trace.started = trace.queued;
+
+        ActiveRequest active{request, url, skip, std::move(trace), repeat};
+
+        if (httpCache)
+        {
+            active.body = httpCache->BeginBody(url);
+        }
+
+        activeRequests[request.GetId()] = std::move(active);
+        request.Start();
+
+        return true;
+    }
+
+    void OnWebRequestState(wxWebRequestEvent &event)
+    {
+        if (event.GetState() == wxWebRequest::State_Active || event.GetState() == wxWebRequest::State_Idle)
+        {
+            return;
+        }
+
+        auto it = activeRequests.find(event.GetRequest().GetId());
+
+        if (it == activeRequests.end())
+        {
+            return;
+        }
+
+        ActiveRequest active = it->second;
+        activeRequests.erase(it);
+
+        active.trace.completed = std::chrono::steady_clock::now();
+        active.trace.state = event.GetState();
+
+        const bool completed = event.GetState() == wxWebRequest::State_Completed;
+        const int status = completed ? event.GetResponse().GetStatus() : 0;
+
+        if (active.stream)
+        {
+            // the parser has had every byte; this tells it whether that was all of them
+            active.trace.bytes = active.receivedBytes;
+            active.stream->Close(completed && status == 200);
+
+            if (completed && status == 200 && httpCache)
+            {
+                httpCache->Resolve(active.url, event.GetResponse(), *active.body);
+            }
+
+            pages[active.skip].trace = active.trace;
+            NotifyIfFinished();
+            return;
+        }
+
+        std::shared_ptr<const ByteSource> body;
+
+        if (completed && (status == 200 || status == 304) && active.body)
+        {
+            body = httpCache->Resolve(active.url, event.GetResponse(), *active.body);
+
+            // the entry was evicted while the request was out; ask again, without validators
+            if (!body && status == 304 && !active.repeated && !finishCallback)
+            {
+                if (StartPage(active.skip, true))
+                {
+                    Metrics::Get().Finish(active.trace);
+                    return;
+                }
+            }
+        }
+
+        if (body)
+        {
+            active.trace.bytes = body->Size();
+        }
+
+        if (body && !finishCallback)
+        {
+            pages[active.skip].trace = active.trace;
+            ParsePage(active.skip, [body](ProductParser::ProductCallback onProduct, ProductParser::PageInfo *info)
+                      { return ProductParser::Parse(body->Data(), body->Data() + body->Size(), std::move(onProduct), info); });
+        }
+        else
+        {
+            Metrics::Get().Finish(active.trace);
+            OnPageParsed(active.skip, false, {});
+        }
+
+        NotifyIfFinished();
+    }
+
+    void OnWebRequestData(wxWebRequestEvent &event)
+    {
+        auto it = activeRequests.find(event.GetRequest().GetId());
+
+        if (it == activeRequests.end())
+        {
+            return;
+        }
+
+        ActiveRequest &active = it->second;
+
+        if (!active.trace.firstByte)
+        {
+            active.trace.firstByte = std::chrono::steady_clock::now();
+        }
+
+        active.receivedBytes += event.GetDataSize();
+
+        if (active.body)
+        {
+            active.body->Append(event.GetDataBuffer(), event.GetDataSize());
+        }
+
+        // only a 200 carries a page; any other body is left to the cache to drop
+        if (!active.stream && !finishCallback && event.GetRequest().GetResponse().GetStatus() == 200)
+        {
+            auto stream = std::make_shared<ChunkStream>();
+            active.stream = stream;
+
+            ParsePage(active.skip, [stream](ProductParser::ProductCallback onProduct, ProductParser::PageInfo *info)
+                      {
+                          std::istream input(stream.get());
+                          const bool ok = ProductParser::Parse(input, std::move(onProduct), info) && !stream->Failed();
+
+                          // past a malformed product, read on to the end, so the page is
+                          // not retried while its request is still out
+                          input.ignore(std::numeric_limits<std::streamsize>::max());
+
+                          return ok; });
+        }
+
+        if (active.stream)
+        {
+            active.stream->Push(event.GetDataBuffer(), event.GetDataSize());
+        }
+    }
+
+    // Runs `parse` on the worker over the page's bytes, whichever way they come;
+    // it hands each product to the callback it is given.
+    using PageParse = std::function<bool(ProductParser::ProductCallback onProduct, ProductParser::PageInfo *info)>;
+
+    void ParsePage(size_t skip, PageParse parse)
+    {
+        const size_t toSkip = pages[skip].toSkip;
+
+        parsePool.Submit([this, skip, parse = std::move(parse), toSkip]()
+                         {
+                             const auto parseStart = std::chrono::steady_clock::now();
+
+                             std::vector<Product> batch;
+                             size_t seen = 0;
+                             bool firstBatch = true;
+
+                             auto flush = [this, skip, &batch, &firstBatch]()
+                             {
+                                 this->CallAfter([this, skip, batch = std::move(batch)]() mutable
+                                                 { OnProductsParsed(skip, std::move(batch)); });
+
+                                 batch = {};
+                                 firstBatch = false;
+                             };
+
+                             ProductParser::PageInfo info;
+
+                             const bool ok = parse([&](Product &&product)
+                                                   {
+                                                       if (seen++ < toSkip)
+                                                       {
+                                                           return true;
+                                                       }
+
+                                                       batch.push_back(std::move(product));
+
+                                                       if (firstBatch || batch.size() >= ProductBatchSize)
+                                                       {
+                                                           flush();
+                                                       }
+
+                                                       return true; }, &info);
+
+                             if (!batch.empty())
+                             {
+                                 flush();
+                             }
+
+                             const auto parseEnd = std::chrono::steady_clock::now();
+
+                             this->CallAfter([this, skip, ok, info, parseStart, parseEnd]()
+                                             {
+                                                 // a streamed page is parsed while it downloads; only the
+                                                 // parsing left after the last byte counts as parse time
+                                                 auto &trace = pages[skip].trace;
+                                                 trace.decodeStart = std::max(parseStart, trace.completed.value_or(parseStart));
+                                                 trace.decodeEnd = parseEnd;
+
+                                                 Metrics::Get().Finish(trace);
+                                                 OnPageParsed(skip, ok, info); }); });
+    }
+
+    void OnProductsParsed(size_t skip, std::vector<Product> &&products)
+    {
+        auto &page = pages[skip];
+        page.received += products.size();
+        page.buffered.insert(page.buffered.end(), std::make_move_iterator(products.begin()), std::make_move_iterator(products.end()));
+
+        DeliverInOrder();
+    }
+
+    void OnPageParsed(size_t skip, bool ok, const ProductParser::PageInfo &info)
+    {
+        auto &page = pages[skip];
+        page.parsed = true;
+        page.failed = !ok;
+
+        if (ok)
+        {
+            total = info.total;
+            retryDelayMs = InitialRetryDelayMs;
+            failureReported = false;
+        }
+        else if (!finishCallback) // not cancelled on the way out
+        {
+            if (!failureReported)
+            {
+                wxLogError("Failed to download products");
+                failureReported = true;
+            }
+
+            wxLogDebug("Catalog: page at %zu failed, retrying in %d ms", skip, retryDelayMs);
+            ScheduleRetry();
+        }
+
+        DeliverInOrder();
+
+        if (ok)
+        {
+            RequestPages(false);
+        }
+    }
+
+    void ScheduleRetry()
+    {
+        if (finishCallback || retryTimer.IsRunning())
+        {
+            return;
+        }
+
+        retryTimer.StartOnce(retryDelayMs);
+        retryDelayMs = std::min(retryDelayMs * 2, MaxRetryDelayMs);
+    }
+
+    void DeliverInOrder()
+    {
+        while (pages.count(appendSkip) > 0)
+        {
+            auto &page = pages[appendSkip];
+
+            if (!page.buffered.empty())
+            {
+                onProducts(std::move(page.buffered));
+                page.buffered.clear();
+            }
+
+            if (!page.parsed || page.failed)
+            {
+                return;
+            }
+
+            pages.erase(appendSkip);
+            appendSkip += pageSize;
+        }
+    }
+
+    void NotifyIfFinished()
+    {
+        if (!IsIdle() || !finishCallback)
+        {
+            return;
+        }
+
+        auto callback = std::move(finishCallback);
+        finishCallback = nullptr;
+        callback();
+    }
+
+    HttpCache *httpCache;
+    ProductsCallback onProducts;
+
+    std::string baseUrl;
+    size_t pageSize;
+    size_t maxOutstanding;
+
+    // pages requested but not yet handed out in full, by skip
+    std::map<size_t, Page> pages;
+    std::map<int, ActiveRequest> activeRequests;
+
+    size_t nextSkip = 0;   // next page to request
+    size_t appendSkip = 0; // next page to hand out
+    std::optional<size_t> total;
+
+    size_t position = 0;
+
+    std::function<void()> finishCallback;
+
+    wxTimer retryTimer;
+    int retryDelayMs = InitialRetryDelayMs;
+    bool failureReported = false;
+
+    // declared last so the workers are joined before anything they post back to;
+    // one per page that may be downloading, since a streamed parse holds its
+    // worker until the last byte is in
+    WorkerPool parsePool;
+};
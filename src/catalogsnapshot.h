@@ -0,0 +1,436 @@
+#pragma once
+
+#include <wx/wx.h>
+#include <wx/stdpaths.h>
+#include <wx/filename.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "bytesource.h"
+#include "catalogstore.h"
+
+// Binary copy of a CatalogStore for startup, read through a memory mapping.
+//
+// Layout, all in native byte order:
+//
+//     Header
+//     ProductRecord[productCount]
+//     ImageRecord[imageCount]
+//     StringRef[labelCount]        brand and category names, by label id
+//     StringRef[fileNameCount]     image file names, by file id
+//     char[stringBytes]            string table, referenced by offset and length
+//
+// Loading checks the header, the checksum and every reference, then points the
+// store's text columns, labels and file names straight into the mapping; only
+// the numeric columns are copied out of the records. The checksum covers the
+// whole file, string table included: a damaged title or image URL would be shown
+// or fetched, so it has to be caught like a damaged record. A snapshot that fails
+// any check is deleted.
+//
+// String references are 32-bit, so a catalog whose strings come to more than
+// 4 GiB is not written at all rather than written with wrapped offsets.
+class CatalogSnapshot
+{
+public:
+    // bump whenever any of the structs below change
+    static constexpr uint32_t Version = 4;
+
+    static wxString DefaultPath()
+    {
+        wxFileName path = wxFileName::DirName(wxStandardPaths::Get().GetUserDir(wxStandardPaths::Dir_Cache));
+        path.AppendDir("wx_webrequest_tutorial");
+        path.SetFullName("catalog.snapshot");
+
+        return path.GetFullPath();
+    }
+
+    // Writes to a temporary file next to `path` and renames it into place, so a
+    // reader never sees half a snapshot. `source` is the feed the products came from.
+    static bool Write(const CatalogStore &store, const std::string &source, const wxString &path)
+    {
+        Builder builder;
+        const std::optional<std::vector<char>> bytes = builder.Build(store, source);
+
+        if (!bytes)
+        {
+            wxLogDebug("Snapshot: string table of %zu products exceeds 4 GiB, not written", store.Size());
+            return false;
+        }
+
+        wxFileName::Mkdir(wxFileName(path).GetPath(), wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+
+        const wxString temporary = path + ".tmp";
+
+        {
+            std::ofstream file(temporary.fn_str(), std::ios::binary | std::ios::trunc);
+            file.write(bytes->data(), bytes->size());
+
+            if (!file)
+            {
+                wxLogDebug("Snapshot: cannot write %s", temporary);
+                return false;
+            }
+        }
+
+        if (!wxRenameFile(temporary, path))
+        {
+            wxRemoveFile(temporary);
+            return false;
+        }
+
+        wxLogDebug("Snapshot: wrote %zu products (%zu bytes) to %s", store.Size(), bytes->size(), path);
+        return true;
+    }
+
+    // Returns nullopt if there is no usable snapshot of `source` at `path`.
+    static std::optional<CatalogStore> Load(const wxString &path, const std::string &source)
+    {
+        if (!wxFileExists(path))
+        {
+            return std::nullopt;
+        }
+
+        std::shared_ptr<const ByteSource> file = MappedFile::Open(path.utf8_string());
+        std::string problem = "cannot map file";
+        std::optional<CatalogStore> store;
+
+        if (file)
+        {
+            store = Read(file, source, problem);
+        }
+
+        if (!store)
+        {
+            wxLogDebug("Snapshot: discarding %s: %s", path, wxString::FromUTF8(problem));
+            wxRemoveFile(path);
+        }
+
+        return store;
+    }
+
+private:
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+
+        uint64_t productCount;
+        uint64_t imageCount;
+        uint64_t labelCount;
+        uint64_t fileNameCount;
+        uint64_t stringBytes;
+
+        // Checksum() of the header, with this field zero, and everything after it
+        uint64_t checksum;
+
+        StringRef source;
+    };
+
+    struct ProductRecord
+    {
+        double price;
+        float rating;
+        uint32_t brandId;
+        uint32_t categoryId;
+        StringRef title;
+        StringRef description;
+        StringRef thumbnailDirectory;
+        uint32_t thumbnailFileId;
+        uint32_t imageCount; // images follow on from the previous product's
+        uint32_t reserved;
+    };
+
+    struct ImageRecord
+    {
+        StringRef directory;
+        uint32_t fileId;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) % 8 == 0, "sections after the header must stay aligned");
+    static_assert(std::is_trivially_copyable_v<ProductRecord> && sizeof(ProductRecord) % 8 == 0, "records must stay aligned");
+    static_assert(std::is_trivially_copyable_v<ImageRecord> && alignof(ImageRecord) == alignof(StringRef), "records must stay aligned");
+
+    static constexpr char Magic[8] = {'W', 'X', 'C', 'A', 'T', 'S', 'N', 'P'};
+    static constexpr uint32_t ByteOrderMark = 0x01020304;
+
+    static constexpr uint64_t ChecksumBasis = 14695981039346656037ull;
+
+    // FNV-1a over 8-byte words rather than bytes, so checking a large snapshot
+    // costs a few milliseconds instead of tens
+    static uint64_t Checksum(const unsigned char *data, size_t size, uint64_t hash = ChecksumBasis)
+    {
+        constexpr uint64_t Prime = 1099511628211ull;
+        size_t i = 0;
+
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            hash = (hash ^ word) * Prime;
+        }
+
+        for (; i < size; i++)
+        {
+            hash = (hash ^ data[i]) * Prime;
+        }
+
+        return hash;
+    }
+
+    static uint64_t FileChecksum(Header header, const unsigned char *rest, size_t size)
+    {
+        header.checksum = 0;
+
+        const uint64_t hash = Checksum(reinterpret_cast<const unsigned char *>(&header), sizeof(Header));
+        return Checksum(rest, size, hash);
+    }
+
+    class Builder
+    {
+    public:
+        // nullopt if the string table outgrows the 32-bit references
+        std::optional<std::vector<char>> Build(const CatalogStore &store, const std::string &sourceUrl)
+        {
+            Header header{};
+            std::memcpy(header.magic, Magic, sizeof(Magic));
+            header.version = Version;
+            header.byteOrder = ByteOrderMark;
+            header.source = Add(sourceUrl);
+
+            std::vector<ProductRecord> products(store.Size());
+            std::vector<ImageRecord> images(store.imageDirectories.size());
+
+            for (size_t i = 0; i < store.Size(); i++)
+            {
+                const size_t firstImage = store.imageOffsets[i];
+
+                for (size_t j = firstImage; j < store.imageOffsets[i + 1]; j++)
+                {
+                    // products keep their images in one directory; store it once
+                    const bool sameDirectory = j > firstImage && store.imageDirectories[j] == store.imageDirectories[j - 1];
+                    images[j] = ImageRecord{sameDirectory ? images[j - 1].directory : Add(store.imageDirectories[j]), store.imageFileIds[j]};
+                }
+
+                const bool thumbnailWithImages = store.ImageCount(i) > 0 && store.thumbnailDirectories[i] == store.imageDirectories[firstImage];
+                const StringRef thumbnailDirectory = thumbnailWithImages ? images[firstImage].directory : Add(store.thumbnailDirectories[i]);
+
+                products[i] = ProductRecord{store.prices[i], store.ratings[i], store.brandIds[i], store.categoryIds[i], Add(store.titles[i]), Add(store.descriptions[i]), thumbnailDirectory, store.thumbnailFileIds[i], static_cast<uint32_t>(store.ImageCount(i)), 0};
+            }
+
+            std::vector<StringRef> labels, fileNames;
+
+            for (uint32_t id = 0; id < store.labels.Size(); id++)
+            {
+                labels.push_back(Add(store.labels.Get(id)));
+            }
+
+            for (uint32_t id = 0; id < store.imageFiles.Size(); id++)
+            {
+                fileNames.push_back(Add(store.imageFiles.Get(id)));
+            }
+
+            header.productCount = products.size();
+            header.imageCount = images.size();
+            header.labelCount = labels.size();
+            header.fileNameCount = fileNames.size();
+            header.stringBytes = strings.size();
+
+            if (overflowed)
+            {
+                return std::nullopt;
+            }
+
+            std::vector<char> bytes(sizeof(Header));
+            Append(bytes, products);
+            Append(bytes, images);
+            Append(bytes, labels);
+            Append(bytes, fileNames);
+            bytes.insert(bytes.end(), strings.begin(), strings.end());
+
+            header.checksum = FileChecksum(header, reinterpret_cast<const unsigned char *>(bytes.data()) + sizeof(Header), bytes.size() - sizeof(Header));
+            std::memcpy(bytes.data(), &header, sizeof(Header));
+
+            return bytes;
+        }
+
+    private:
+        StringRef Add(std::string_view text)
+        {
+            // strings never grows past UINT32_MAX, so this cannot underflow
+            if (text.size() > UINT32_MAX - strings.size())
+            {
+                overflowed = true;
+                return {};
+            }
+
+            const StringRef ref{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size())};
+            strings.insert(strings.end(), text.begin(), text.end());
+
+            return ref;
+        }
+
+        template <typename T>
+        static void Append(std::vector<char> &bytes, const std::vector<T> &items)
+        {
+            const char *begin = reinterpret_cast<const char *>(items.data());
+            bytes.insert(bytes.end(), begin, begin + items.size() * sizeof(T));
+        }
+
+        std::vector<char> strings;
+        bool overflowed = false;
+    };
+
+    static std::optional<CatalogStore> Read(std::shared_ptr<const ByteSource> file, const std::string &source, std::string &problem)
+    {
+        const unsigned char *data = file->Data();
+        const size_t size = file->Size();
+
+        if (size < sizeof(Header))
+        {
+            problem = "truncated header";
+            return std::nullopt;
+        }
+
+        const Header &header = *reinterpret_cast<const Header *>(data);
+
+        if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.byteOrder != ByteOrderMark)
+        {
+            problem = "not a snapshot";
+            return std::nullopt;
+        }
+
+        if (header.version != Version)
+        {
+            problem = "version " + std::to_string(header.version) + ", expected " + std::to_string(Version);
+            return std::nullopt;
+        }
+
+        // sizes are checked one section at a time so a corrupt count cannot overflow the sum
+        size_t offset = sizeof(Header);
+
+        auto section = [&](uint64_t count, size_t itemSize) -> const unsigned char *
+        {
+            if (count > (size - offset) / itemSize)
+            {
+                return nullptr;
+            }
+
+            const unsigned char *begin = data + offset;
+            offset += count * itemSize;
+
+            return begin;
+        };
+
+        auto products = reinterpret_cast<const ProductRecord *>(section(header.productCount, sizeof(ProductRecord)));
+        auto images = reinterpret_cast<const ImageRecord *>(section(header.imageCount, sizeof(ImageRecord)));
+        auto labels = reinterpret_cast<const StringRef *>(section(header.labelCount, sizeof(StringRef)));
+        auto fileNames = reinterpret_cast<const StringRef *>(section(header.fileNameCount, sizeof(StringRef)));
+        auto strings = reinterpret_cast<const char *>(section(header.stringBytes, 1));
+
+        if (!products || !images || !labels || !fileNames || !strings || offset != size)
+        {
+            problem = "section sizes do not match the file";
+            return std::nullopt;
+        }
+
+        if (FileChecksum(header, data + sizeof(Header), size - sizeof(Header)) != header.checksum)
+        {
+            problem = "checksum mismatch";
+            return std::nullopt;
+        }
+
+        bool valid = true;
+
+        auto text = [&](StringRef ref) -> std::string_view
+        {
+            if (ref.offset > header.stringBytes || ref.length > header.stringBytes - ref.offset)
+            {
+                valid = false;
+                return {};
+            }
+
+            return {strings + ref.offset, ref.length};
+        };
+
+        if (text(header.source) != source)
+        {
+            problem = "snapshot of a different feed";
+            return std::nullopt;
+        }
+
+        CatalogStore store;
+        store.Reserve(header.productCount);
+        store.imageDirectories.reserve(header.imageCount);
+        store.imageFileIds.reserve(header.imageCount);
+        store.backing = file;
+
+        // adopting in id order on an empty store reproduces the snapshot's ids;
+        // a duplicate name would not, and fails the check
+        for (uint64_t id = 0; id < header.labelCount; id++)
+        {
+            valid &= store.labels.Adopt(text(labels[id])) == id;
+        }
+
+        for (uint64_t id = 0; id < header.fileNameCount; id++)
+        {
+            valid &= store.imageFiles.Adopt(text(fileNames[id])) == id;
+        }
+
+        uint64_t image = 0;
+
+        for (uint64_t i = 0; i < header.productCount && valid; i++)
+        {
+            const ProductRecord &record = products[i];
+
+            valid = record.brandId < header.labelCount && record.categoryId < header.labelCount && record.thumbnailFileId < header.fileNameCount && record.imageCount <= header.imageCount - image;
+
+            if (!valid)
+            {
+                break;
+            }
+
+            store.prices.push_back(record.price);
+            store.ratings.push_back(record.rating);
+            store.brandIds.push_back(record.brandId);
+            store.categoryIds.push_back(record.categoryId);
+            store.titles.push_back(text(record.title));
+            store.descriptions.push_back(text(record.description));
+
+            for (uint32_t j = 0; j < record.imageCount; j++, image++)
+            {
+                valid &= images[image].fileId < header.fileNameCount;
+
+                store.imageDirectories.push_back(text(images[image].directory));
+                store.imageFileIds.push_back(images[image].fileId);
+            }
+
+            store.imageOffsets.push_back(static_cast<uint32_t>(image));
+
+            store.thumbnailDirectories.push_back(text(record.thumbnailDirectory));
+            store.thumbnailFileIds.push_back(record.thumbnailFileId);
+        }
+
+        if (!valid || image != header.imageCount)
+        {
+            problem = "reference out of range";
+            return std::nullopt;
+        }
+
+        return store;
+    }
+};
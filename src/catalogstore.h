@@ -0,0 +1,399 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bytesource.h"
+#include "product.h"
+
+// Append-only storage for character data. Blocks are never moved or freed while
+// the arena lives, so views into it stay valid as more strings are added.
+class StringArena
+{
+public:
+    static constexpr size_t BlockSize = 256 * 1024;
+
+    std::string_view Store(std::string_view text)
+    {
+        if (text.empty())
+        {
+            return {};
+        }
+
+        // big strings get a block of their own instead of wasting the rest of the current one
+        if (text.size() > BlockSize / 4)
+        {
+            return {Copy(NewBlock(text.size()), text), text.size()};
+        }
+
+        if (text.size() > remaining)
+        {
+            cursor = NewBlock(BlockSize);
+            remaining = BlockSize;
+        }
+
+        const char *stored = Copy(cursor, text);
+        cursor += text.size();
+        remaining -= text.size();
+
+        return {stored, text.size()};
+    }
+
+    size_t GetReservedBytes() const
+    {
+        return reservedBytes;
+    }
+
+private:
+    char *NewBlock(size_t size)
+    {
+        blocks.push_back(std::make_unique<char[]>(size));
+        reservedBytes += size;
+
+        return blocks.back().get();
+    }
+
+    static const char *Copy(char *destination, std::string_view text)
+    {
+        std::memcpy(destination, text.data(), text.size());
+        return destination;
+    }
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *cursor = nullptr;
+    size_t remaining = 0;
+    size_t reservedBytes = 0;
+};
+
+// Maps each distinct string to a small id; the text is stored once in an arena.
+class StringInterner
+{
+public:
+    uint32_t Intern(std::string_view text)
+    {
+        auto it = ids.find(text);
+
+        if (it != ids.end())
+        {
+            return it->second;
+        }
+
+        const std::string_view stored = arena.Store(text);
+        const uint32_t id = static_cast<uint32_t>(strings.size());
+
+        strings.push_back(stored);
+        ids.emplace(stored, id);
+
+        return id;
+    }
+
+    // Like Intern, but keeps a view of `text` instead of copying it, for text
+    // that outlives the interner, such as a mapped snapshot.
+    uint32_t Adopt(std::string_view text)
+    {
+        auto [it, added] = ids.emplace(text, static_cast<uint32_t>(strings.size()));
+
+        if (added)
+        {
+            strings.push_back(text);
+        }
+
+        return it->second;
+    }
+
+    std::string_view Get(uint32_t id) const
+    {
+        return strings[id];
+    }
+
+    size_t Size() const
+    {
+        return strings.size();
+    }
+
+    size_t GetMemoryBytes() const
+    {
+        // bucket array plus one node per entry, roughly
+        return arena.GetReservedBytes() + strings.capacity() * sizeof(std::string_view) + ids.bucket_count() * sizeof(void *) + ids.size() * (sizeof(std::string_view) + sizeof(uint32_t) + 2 * sizeof(void *));
+    }
+
+private:
+    StringArena arena;
+    std::vector<std::string_view> strings;
+    std::unordered_map<std::string_view, uint32_t> ids;
+};
+
+class CatalogStore;
+
+// Read-only view of one product in a CatalogStore. Cheap to copy; the strings stay
+// valid for as long as the store does.
+struct ProductView
+{
+    std::string_view title;
+    double price;
+    std::string_view brand;
+    std::string_view category;
+    double rating;
+    std::string_view description;
+
+    const CatalogStore *store;
+    size_t index;
+
+    size_t ImageCount() const;
+    std::vector<std::string> ImageUrls() const;
+    std::string ThumbnailUrl() const;
+};
+
+// Column-oriented product catalog for large catalogs.
+//
+// Brands and categories are interned, since a few dozen of them repeat across
+// the whole catalog. Price and rating live in contiguous arrays, so scanning or
+// sorting by them does not drag the text through the cache. Titles, descriptions
+// and image URLs are copied into one append-only arena instead of a heap
+// allocation per string.
+//
+// Image URLs are split at the last '/'. A product usually keeps all its images
+// in one directory, so the directory is stored once per product and the file
+// names ("1.png", "thumbnail.webp") are interned. The thumbnail is split the
+// same way and shares the directory of the images when it is in the same one.
+class CatalogStore
+{
+public:
+    size_t Append(Product &&product)
+    {
+        const size_t index = prices.size();
+
+        prices.push_back(product.price);
+        ratings.push_back(static_cast<float>(product.rating));
+
+        brandIds.push_back(labels.Intern(product.brand));
+        categoryIds.push_back(labels.Intern(product.category));
+
+        titles.push_back(arena.Store(product.title));
+        descriptions.push_back(arena.Store(product.description));
+
+        const size_t firstImage = imageDirectories.size();
+
+        for (const std::string_view url : product.imageUrls)
+        {
+            const size_t split = url.rfind('/') + 1; // 0 without a slash
+            const std::string_view directory = url.substr(0, split);
+
+            if (imageDirectories.size() > firstImage && imageDirectories.back() == directory)
+            {
+                imageDirectories.push_back(imageDirectories.back());
+            }
+            else
+            {
+                imageDirectories.push_back(arena.Store(directory));
+            }
+
+            imageFileIds.push_back(imageFiles.Intern(url.substr(split)));
+        }
+
+        imageOffsets.push_back(static_cast<uint32_t>(imageDirectories.size()));
+
+        const std::string_view thumbnail = product.thumbnailUrl;
+        const size_t split = thumbnail.rfind('/') + 1;
+        const std::string_view directory = thumbnail.substr(0, split);
+
+        if (imageDirectories.size() > firstImage && imageDirectories[firstImage] == directory)
+        {
+            thumbnailDirectories.push_back(imageDirectories[firstImage]);
+        }
+        else
+        {
+            thumbnailDirectories.push_back(arena.Store(directory));
+        }
+
+        thumbnailFileIds.push_back(imageFiles.Intern(thumbnail.substr(split)));
+
+        return index;
+    }
+
+    void Append(std::vector<Product> &&products)
+    {
+        for (auto &product : products)
+        {
+            Append(std::move(product));
+        }
+    }
+
+    void Reserve(size_t count)
+    {
+        prices.reserve(count);
+        ratings.reserve(count);
+        brandIds.reserve(count);
+        categoryIds.reserve(count);
+        titles.reserve(count);
+        descriptions.reserve(count);
+        imageOffsets.reserve(count + 1);
+        thumbnailDirectories.reserve(count);
+        thumbnailFileIds.reserve(count);
+    }
+
+    size_t Size() const
+    {
+        return prices.size();
+    }
+
+    bool Empty() const
+    {
+        return prices.empty();
+    }
+
+    ProductView Get(size_t index) const
+    {
+        return ProductView{
+            titles[index],
+            prices[index],
+            labels.Get(brandIds[index]),
+            labels.Get(categoryIds[index]),
+            ratings[index],
+            descriptions[index],
+            this,
+            index};
+    }
+
+    size_t ImageCount(size_t index) const
+    {
+        return imageOffsets[index + 1] - imageOffsets[index];
+    }
+
+    std::string ImageUrl(size_t index, size_t image) const
+    {
+        const size_t i = imageOffsets[index] + image;
+        const std::string_view file = imageFiles.Get(imageFileIds[i]);
+
+        std::string url;
+        url.reserve(imageDirectories[i].size() + file.size());
+        url.append(imageDirectories[i]).append(file);
+
+        return url;
+    }
+
+    std::vector<std::string> ImageUrls(size_t index) const
+    {
+        std::vector<std::string> urls;
+        urls.reserve(ImageCount(index));
+
+        for (size_t image = 0; image < ImageCount(index); image++)
+        {
+            urls.push_back(ImageUrl(index, image));
+        }
+
+        return urls;
+    }
+
+    // empty if the product has none
+    std::string ThumbnailUrl(size_t index) const
+    {
+        const std::string_view file = imageFiles.Get(thumbnailFileIds[index]);
+
+        std::string url;
+        url.reserve(thumbnailDirectories[index].size() + file.size());
+        url.append(thumbnailDirectories[index]).append(file);
+
+        return url;
+    }
+
+    ProductView operator[](size_t index) const
+    {
+        return Get(index);
+    }
+
+    // hot columns, for scans that only need the numbers
+    const std::vector<double> &Prices() const
+    {
+        return prices;
+    }
+
+    const std::vector<float> &Ratings() const
+    {
+        return ratings;
+    }
+
+    const std::vector<uint32_t> &BrandIds() const
+    {
+        return brandIds;
+    }
+
+    const std::vector<uint32_t> &CategoryIds() const
+    {
+        return categoryIds;
+    }
+
+    std::string_view Label(uint32_t id) const
+    {
+        return labels.Get(id);
+    }
+
+    // brands and categories share one id space
+    size_t LabelCount() const
+    {
+        return labels.Size();
+    }
+
+    std::string_view Title(size_t index) const
+    {
+        return titles[index];
+    }
+
+    std::string_view Description(size_t index) const
+    {
+        return descriptions[index];
+    }
+
+    size_t GetMemoryBytes() const
+    {
+        return prices.capacity() * sizeof(double) + ratings.capacity() * sizeof(float) + (brandIds.capacity() + categoryIds.capacity() + imageOffsets.capacity()) * sizeof(uint32_t) + (titles.capacity() + descriptions.capacity() + imageDirectories.capacity() + thumbnailDirectories.capacity()) * sizeof(std::string_view) + (imageFileIds.capacity() + thumbnailFileIds.capacity()) * sizeof(uint32_t) + arena.GetReservedBytes() + labels.GetMemoryBytes() + imageFiles.GetMemoryBytes();
+    }
+
+private:
+    // fills the columns directly when loading
+    friend class CatalogSnapshot;
+
+    std::vector<double> prices;
+    std::vector<float> ratings;
+
+    std::vector<uint32_t> brandIds, categoryIds;
+    StringInterner labels;
+
+    std::vector<std::string_view> titles, descriptions;
+
+    // the images of product i are entries imageOffsets[i] .. imageOffsets[i + 1]
+    std::vector<std::string_view> imageDirectories;
+    std::vector<uint32_t> imageFileIds;
+    std::vector<uint32_t> imageOffsets{0};
+    StringInterner imageFiles;
+
+    // thumbnail file names are interned along with the image file names
+    std::vector<std::string_view> thumbnailDirectories;
+    std::vector<uint32_t> thumbnailFileIds;
+
+    StringArena arena;
+
+    // a mapped snapshot the text columns point into, if loaded from one
+    std::shared_ptr<const ByteSource> backing;
+};
+
+inline size_t ProductView::ImageCount() const
+{
+    return store->ImageCount(index);
+}
+
+inline std::vector<std::string> ProductView::ImageUrls() const
+{
+    return store->ImageUrls(index);
+}
+
+inline std::string ProductView::ThumbnailUrl() const
+{
+    return store->ThumbnailUrl(index);
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <wx/wx.h>
+#include <wx/graphics.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+#include <optional>
+
+#include "animationclock.h"
+#include "metrics.h"
+
+// Frame timing of one window, for the gallery's profiler overlay: paint
+// durations, intervals between animator ticks, bitmaps drawn per paint and
+// frames dropped during slides. Only built with GALLERY_PROFILER defined (the
+// CMake option of the same name); without it the gallery has no trace of it.
+class FrameProfiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t HistoryLength = 120;
+
+    // Times a paint from construction to destruction. Declare it before the
+    // paint DC, so the final blit of a buffered DC is included.
+    class PaintScope
+    {
+    public:
+        PaintScope(FrameProfiler &profiler) : profiler(profiler), start(Clock::now())
+        {
+            profiler.bitmapsDrawn = 0;
+        }
+
+        ~PaintScope()
+        {
+            const auto total = Clock::now() - start;
+
+            profiler.OnPaint(std::chrono::duration<double, std::milli>(total - excluded).count(),
+                             std::chrono::duration<double, std::milli>(excluded).count());
+        }
+
+        // Leaves the time of `draw` out of the paint, for the overlays drawn over
+        // the gallery. `gc` is flushed on both sides, so drawing it queues is
+        // rendered inside and the gallery's own drawing outside.
+        template <typename F>
+        void Exclude(wxGraphicsContext *gc, F &&draw)
+        {
+            gc->Flush();
+            const auto excludeStart = Clock::now();
+
+            draw();
+
+            gc->Flush();
+            excluded += Clock::now() - excludeStart;
+        }
+
+    private:
+        FrameProfiler &profiler;
+        Clock::time_point start;
+        Clock::duration excluded{};
+    };
+
+    bool enabled = false;
+
+    void OnBitmapDrawn()
+    {
+        bitmapsDrawn++;
+    }
+
+    void OnSlideStart()
+    {
+        slideStart = Clock::now();
+        lastTick.reset();
+        paintsThisSlide = 0;
+        excludedThisSlide = 0;
+    }
+
+    void OnAnimatorTick()
+    {
+        const auto now = Clock::now();
+
+        if (lastTick)
+        {
+            tickIntervals.Push(std::chrono::duration<double, std::milli>(now - *lastTick).count());
+        }
+
+        lastTick = now;
+    }
+
+    // frames the display could have shown during the slide but no paint made
+    // it; time spent drawing the overlays does not count as slide time
+    void OnSlideEnd()
+    {
+        if (!slideStart)
+        {
+            return;
+        }
+
+        const double slideMs = std::chrono::duration<double, std::milli>(Clock::now() - *slideStart).count() - excludedThisSlide;
+        const double frameMs = 1000.0 / AnimationClock::Get().GetTargetFps();
+        const int expected = static_cast<int>(std::floor(slideMs / frameMs));
+
+        lastSlideDropped = std::max(0, expected - paintsThisSlide);
+        totalDropped += lastSlideDropped;
+        slides++;
+
+        slideStart.reset();
+    }
+
+    // graph of recent paints over the bottom of `area`, histogram and numbers above it
+    void Draw(wxGraphicsContext *gc, const wxRect &area, double scale, const wxGraphicsFont &font)
+    {
+        PrepareGraphicsResources(gc);
+
+        const double frameMs = 1000.0 / AnimationClock::Get().GetTargetFps();
+
+        const double graphHeight = 60 * scale;
+        const double graphTop = area.GetBottom() - graphHeight;
+        const double barWidth = static_cast<double>(area.GetWidth()) / HistoryLength;
+        const double msToPixels = graphHeight / (2 * frameMs); // two frames tall
+
+        gc->SetPen(wxNullGraphicsPen);
+        gc->SetBrush(backgroundBrush);
+        gc->DrawRectangle(area.GetLeft(), graphTop, area.GetWidth(), graphHeight);
+
+        for (size_t i = 0; i < paintDurations.Size(); i++)
+        {
+            const double ms = paintDurations.At(i);
+            const double height = std::min(graphHeight, ms * msToPixels);
+
+            gc->SetBrush(ms > frameMs ? overBudgetBrush : withinBudgetBrush);
+            gc->DrawRectangle(area.GetLeft() + i * barWidth, area.GetBottom() - height, std::max(1.0, barWidth - 1), height);
+        }
+
+        // the frame budget
+        gc->SetPen(budgetPen);
+        gc->StrokeLine(area.GetLeft(), area.GetBottom() - frameMs * msToPixels, area.GetRight(), area.GetBottom() - frameMs * msToPixels);
+
+        wxString text = wxString::Format("paint    p50 %5.1f  p95 %5.1f  p99 %5.1f  max %5.1f ms (%zu)\n",
+                                         paintHistogram.Percentile(50), paintHistogram.Percentile(95), paintHistogram.Percentile(99), paintDurations.Max(), paintHistogram.Count());
+        text += wxString::Format("tick     mean %5.1f  max %5.1f ms, target %.1f\n", tickIntervals.Mean(), tickIntervals.Max(), frameMs);
+        text += wxString::Format("drawn    %zu bitmaps last paint, %.1f mean\n", lastBitmapsDrawn, bitmapsPerPaint.Mean());
+        text += wxString::Format("dropped  %d last slide, %d in %d slides\n", lastSlideDropped, totalDropped, slides);
+
+        // paint durations by fraction of the frame budget
+        static constexpr double bounds[] = {0.125, 0.25, 0.5, 1, 2};
+        std::array<int, std::size(bounds) + 1> counts{};
+
+        for (size_t i = 0; i < paintDurations.Size(); i++)
+        {
+            const double fraction = paintDurations.At(i) / frameMs;
+            counts[std::upper_bound(std::begin(bounds), std::end(bounds), fraction) - std::begin(bounds)]++;
+        }
+
+        static const char *labels[] = {"<1/8", "<1/4", "<1/2", "<1", "<2", ">=2"};
+
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            text += wxString::Format("%-5s frame %s\n", labels[i], wxString('#', counts[i] * 40 / HistoryLength + (counts[i] > 0)));
+        }
+
+        gc->SetFont(font);
+
+        double charWidth, lineHeight;
+        gc->GetTextExtent("M", &charWidth, &lineHeight);
+
+        const wxArrayString lines = wxSplit(text.Trim(), '\n');
+        const double textTop = graphTop - lines.size() * lineHeight - 8 * scale;
+
+        gc->SetPen(wxNullGraphicsPen);
+        gc->SetBrush(backgroundBrush);
+        gc->DrawRectangle(area.GetLeft(), textTop, area.GetWidth(), graphTop - textTop);
+
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            gc->DrawText(lines[i], area.GetLeft() + 4 * scale, textTop + 4 * scale + i * lineHeight);
+        }
+    }
+
+    // drops the native pens and brushes; the next Draw rebuilds them
+    void InvalidateGraphicsResources()
+    {
+        graphicsRenderer = nullptr;
+    }
+
+private:
+    // the last HistoryLength values, oldest first
+    class Ring
+    {
+    public:
+        void Push(double value)
+        {
+            values[next] = value;
+            next = (next + 1) % HistoryLength;
+            size = std::min(size + 1, HistoryLength);
+        }
+
+        size_t Size() const
+        {
+            return size;
+        }
+
+        double At(size_t i) const
+        {
+            return values[(next + HistoryLength - size + i) % HistoryLength];
+        }
+
+        double Mean() const
+        {
+            double sum = 0;
+
+            for (size_t i = 0; i < size; i++)
+            {
+                sum += At(i);
+            }
+
+            return size > 0 ? sum / size : 0;
+        }
+
+        double Max() const
+        {
+            double max = 0;
+
+            for (size_t i = 0; i < size; i++)
+            {
+                max = std::max(max, At(i));
+            }
+
+            return max;
+        }
+
+    private:
+        std::array<double, HistoryLength> values{};
+        size_t next = 0, size = 0;
+    };
+
+    void OnPaint(double ms, double excludedMs)
+    {
+        paintDurations.Push(ms);
+        paintHistogram.Record(ms);
+        bitmapsPerPaint.Push(static_cast<double>(bitmapsDrawn));
+        lastBitmapsDrawn = bitmapsDrawn;
+
+        if (slideStart)
+        {
+            paintsThisSlide++;
+            excludedThisSlide += excludedMs;
+        }
+    }
+
+    Ring paintDurations, tickIntervals, bitmapsPerPaint;
+    Histogram paintHistogram;
+
+    size_t bitmapsDrawn = 0, lastBitmapsDrawn = 0;
+
+    std::optional<Clock::time_point> slideStart, lastTick;
+    int paintsThisSlide = 0;
+    double excludedThisSlide = 0;
+    int lastSlideDropped = 0, totalDropped = 0, slides = 0;
+
+    // created once per renderer, like the gallery's own; null until prepared
+    wxGraphicsRenderer *graphicsRenderer = nullptr;
+
+    wxGraphicsBrush backgroundBrush, overBudgetBrush, withinBudgetBrush;
+    wxGraphicsPen budgetPen;
+
+    void PrepareGraphicsResources(wxGraphicsContext *gc)
+    {
+        if (graphicsRenderer)
+        {
+            return;
+        }
+
+        graphicsRenderer = gc->GetRenderer();
+
+        backgroundBrush = graphicsRenderer->CreateBrush(wxBrush(wxColor(0, 0, 0, 160)));
+        overBudgetBrush = graphicsRenderer->CreateBrush(wxBrush(wxColor(230, 60, 60)));
+        withinBudgetBrush = graphicsRenderer->CreateBrush(wxBrush(wxColor(90, 200, 90)));
+        budgetPen = graphicsRenderer->CreatePen(wxGraphicsPenInfo(wxColor(255, 255, 255, 160)));
+    }
+};
@@ -0,0 +1,512 @@
+#pragma once
+
+#include <wx/wx.h>
+#include <wx/webrequest.h>
+#include <wx/stdpaths.h>
+#include <wx/filename.h>
+#include <wx/dir.h>
+#include <wx/timer.h>
+
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "bytesource.h"
+#include "lrucache.h"
+
+// A response body that arrives in chunks (Storage_None). Bodies headed for the
+// cache are written straight to a file in it, so they never sit in memory whole;
+// without a cache they are buffered.
+class StreamedBody
+{
+public:
+    // an empty path buffers in memory
+    explicit StreamedBody(const wxString &path = wxString()) : path(path)
+    {
+        if (!path.empty())
+        {
+            file.open(path.fn_str(), std::ios::binary | std::ios::trunc);
+        }
+    }
+
+    ~StreamedBody()
+    {
+        Discard();
+    }
+
+    StreamedBody(const StreamedBody &) = delete;
+    StreamedBody &operator=(const StreamedBody &) = delete;
+
+    void Append(const void *data, size_t size)
+    {
+        const char *bytes = static_cast<const char *>(data);
+
+        if (IsFile())
+        {
+            file.write(bytes, size);
+        }
+        else
+        {
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+
+        received += size;
+    }
+
+    bool IsFile() const
+    {
+        return !path.empty();
+    }
+
+    bool IsOk() const
+    {
+        return !IsFile() || (file.is_open() && file.good());
+    }
+
+    size_t Size() const
+    {
+        return received;
+    }
+
+    // ends a file body and returns its path; the caller takes over the file
+    wxString Close()
+    {
+        file.close();
+        closed = true;
+
+        return path;
+    }
+
+    std::shared_ptr<const ByteSource> TakeBuffer()
+    {
+        return std::make_shared<MemoryBytes>(std::move(buffer));
+    }
+
+    void Discard()
+    {
+        if (IsFile() && !closed)
+        {
+            file.close();
+            closed = true;
+            wxRemoveFile(path);
+        }
+
+        buffer.clear();
+    }
+
+private:
+    wxString path;
+    std::ofstream file;
+    bool closed = false;
+
+    std::vector<unsigned char> buffer;
+    size_t received = 0;
+};
+
+// Persistent HTTP cache shared by the product feed and the image loader.
+//
+// Bodies are stored one file per URL next to an index holding the ETag and
+// Last-Modified validators. Requests are revalidated rather than trusted blindly:
+// PrepareRequest adds If-None-Match / If-Modified-Since and a 304 reply is served
+// from the cached file, memory-mapped instead of read into a buffer.
+//
+// The index is rewritten SaveDelayMs after the first change since the last save,
+// on Clear and on destruction, not on every store. Body files it does not list,
+// left over from a crash or from a delete that failed while the file was still
+// mapped, are swept on startup.
+class HttpCache
+{
+public:
+    static constexpr size_t DefaultCapacityBytes = 256 * 1024 * 1024;
+    static constexpr int SaveDelayMs = 2000;
+
+    static wxString DefaultDirectory()
+    {
+        wxFileName dir = wxFileName::DirName(wxStandardPaths::Get().GetUserDir(wxStandardPaths::Dir_Cache));
+        dir.AppendDir("wx_webrequest_tutorial");
+        dir.AppendDir("http");
+
+        return dir.GetPath();
+    }
+
+    HttpCache(const wxString &directory = DefaultDirectory(), size_t capacityBytes = DefaultCapacityBytes)
+        : directory(directory), entries(capacityBytes, EntryBytes)
+    {
+        isUsable = wxFileName::Mkdir(directory, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+
+        if (!isUsable)
+        {
+            wxLogDebug("HTTP cache disabled: cannot create %s", directory);
+            return;
+        }
+
+        entries.SetEvictionCallback([this](const std::string &url, const Entry &entry)
+                                    { RemoveBodyFile(entry); });
+
+        LoadIndex();
+        RemoveUnlistedFiles();
+
+        saveTimer.Bind(wxEVT_TIMER, [this](wxTimerEvent &)
+                       { SaveIndex(); });
+    }
+
+    ~HttpCache()
+    {
+        SaveIndex();
+    }
+
+    HttpCache(const HttpCache &) = delete;
+    HttpCache &operator=(const HttpCache &) = delete;
+
+    bool IsUsable() const
+    {
+        return isUsable;
+    }
+
+    // Call before Start(). Adds the conditional headers for a URL we already hold.
+    void PrepareRequest(wxWebRequest &request, const std::string &url) const
+    {
+        if (!isUsable)
+        {
+            return;
+        }
+
+        const Entry *entry = entries.Peek(url);
+
+        if (!entry || !FileExists(*entry))
+        {
+            return;
+        }
+
+        if (!entry->etag.empty())
+        {
+            request.SetHeader("If-None-Match", wxString::FromUTF8(entry->etag));
+        }
+
+        if (!entry->lastModified.empty())
+        {
+            request.SetHeader("If-Modified-Since", wxString::FromUTF8(entry->lastModified));
+        }
+    }
+
+    // For requests with Storage_None: the body to stream the DATA events into,
+    // a file in the cache directory if it is usable.
+    std::unique_ptr<StreamedBody> BeginBody(const std::string &url)
+    {
+        if (!isUsable)
+        {
+            return std::make_unique<StreamedBody>();
+        }
+
+        return std::make_unique<StreamedBody>(wxFileName(directory, wxString::FromUTF8(NextFileName(url) + ".part")).GetFullPath());
+    }
+
+    // Call on State_Completed. Returns the body to use for this URL: the cached
+    // file on 304, the freshly stored one on 200, or nullptr if neither is usable.
+    // A 304 whose entry has gone since PrepareRequest (evicted by another store)
+    // also gives nullptr; PrepareRequest no longer adds the conditional headers
+    // then, so the caller can simply repeat the request. The body is used up
+    // either way.
+    std::shared_ptr<const ByteSource> Resolve(const std::string &url, const wxWebResponse &response, StreamedBody &body)
+    {
+        if (!body.IsOk())
+        {
+            return nullptr;
+        }
+
+        if (!body.IsFile())
+        {
+            return body.TakeBuffer();
+        }
+
+        if (response.GetStatus() == 304)
+        {
+            body.Discard();
+            return CachedBody(url);
+        }
+
+        const wxString source = body.Close();
+
+        if (auto stored = StoreBody(url, response, source))
+        {
+            return stored;
+        }
+
+        // unlinking only drops the name; the mapping keeps the bytes
+        auto mapped = MappedFile::Open(source.utf8_string());
+        wxRemoveFile(source);
+
+        return mapped;
+    }
+
+    void Clear()
+    {
+        entries.ForEachOldestFirst([this](const std::string &url, const Entry &entry)
+                                   { RemoveBodyFile(entry); });
+        entries.Clear();
+
+        indexDirty = true;
+        SaveIndex();
+    }
+
+    void SetCapacity(size_t bytes)
+    {
+        entries.SetBudget(bytes);
+        ScheduleSave();
+    }
+
+    size_t GetBytes() const
+    {
+        return entries.GetBytes();
+    }
+
+    size_t GetRevalidatedHits() const
+    {
+        return hits;
+    }
+
+    size_t GetStores() const
+    {
+        return stores;
+    }
+
+private:
+    std::shared_ptr<const ByteSource> CachedBody(const std::string &url)
+    {
+        const Entry *entry = entries.Find(url);
+
+        if (!entry)
+        {
+            return nullptr;
+        }
+
+        auto body = MappedFile::Open(BodyPath(*entry).utf8_string());
+
+        if (!body)
+        {
+            // gone from disk; forget it, so the repeated request is unconditional
+            entries.Erase(url);
+        }
+        else
+        {
+            hits++;
+        }
+
+        ScheduleSave();
+        return body;
+    }
+
+    // moves a downloaded body file into the cache; nullptr if that fails
+    std::shared_ptr<const ByteSource> StoreBody(const std::string &url, const wxWebResponse &response, const wxString &source)
+    {
+        Entry entry;
+        entry.etag = response.GetHeader("ETag").utf8_string();
+        entry.lastModified = response.GetHeader("Last-Modified").utf8_string();
+        entry.file = NextFileName(url);
+
+        if (source.empty() || !wxRenameFile(source, BodyPath(entry)))
+        {
+            wxLogDebug("HTTP cache: could not store %s", url);
+            return nullptr;
+        }
+
+        auto body = MappedFile::Open(BodyPath(entry).utf8_string());
+
+        if (!body)
+        {
+            wxRemoveFile(BodyPath(entry));
+            return nullptr;
+        }
+
+        entry.size = body->Size();
+
+        if (const Entry *previous = entries.Peek(url))
+        {
+            RemoveBodyFile(*previous);
+        }
+
+        entries.Put(url, entry);
+
+        // bigger than the whole budget: used this once, not kept
+        if (!entries.Contains(url))
+        {
+            RemoveBodyFile(entry);
+        }
+
+        stores++;
+        ScheduleSave();
+
+        return body;
+    }
+
+    struct Entry
+    {
+        std::string file;
+        std::string etag;
+        std::string lastModified;
+        size_t size = 0;
+    };
+
+    static size_t EntryBytes(const Entry &entry)
+    {
+        return entry.size;
+    }
+
+    wxString BodyPath(const Entry &entry) const
+    {
+        return wxFileName(directory, wxString::FromUTF8(entry.file)).GetFullPath();
+    }
+
+    wxString IndexPath() const
+    {
+        return wxFileName(directory, "index.json").GetFullPath();
+    }
+
+    bool FileExists(const Entry &entry) const
+    {
+        return wxFileExists(BodyPath(entry));
+    }
+
+    void RemoveBodyFile(const Entry &entry)
+    {
+        // on Windows this fails while a mapping is still open; the orphan is
+        // removed by RemoveUnlistedFiles on the next start
+        wxRemoveFile(BodyPath(entry));
+    }
+
+    // body files and partial downloads the index does not know about
+    void RemoveUnlistedFiles()
+    {
+        std::set<std::string> listed;
+
+        entries.ForEachOldestFirst([&listed](const std::string &url, const Entry &entry)
+                                   { listed.insert(entry.file); });
+
+        wxDir dir(directory);
+        std::vector<wxString> unlisted;
+        wxString name;
+
+        for (bool found = dir.IsOpened() && dir.GetFirst(&name, wxEmptyString, wxDIR_FILES); found; found = dir.GetNext(&name))
+        {
+            if ((name.EndsWith(".body") || name.EndsWith(".part")) && listed.count(name.utf8_string()) == 0)
+            {
+                unlisted.push_back(name);
+            }
+        }
+
+        for (const auto &file : unlisted)
+        {
+            wxRemoveFile(wxFileName(directory, file).GetFullPath());
+        }
+
+        if (!unlisted.empty())
+        {
+            wxLogDebug("HTTP cache: removed %zu unlisted files", unlisted.size());
+        }
+    }
+
+    void ScheduleSave()
+    {
+        indexDirty = true;
+
+        if (!saveTimer.IsRunning())
+        {
+            saveTimer.StartOnce(SaveDelayMs);
+        }
+    }
+
+    // a fresh name per store, so a body still mapped by a consumer is never overwritten
+    std::string NextFileName(const std::string &url)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%016zx-%llu.body", std::hash<std::string>{}(url), ++fileCounter);
+
+        return name;
+    }
+
+    void LoadIndex()
+    {
+        std::ifstream file(IndexPath().fn_str(), std::ios::binary);
+
+        if (!file)
+        {
+            return;
+        }
+
+        auto index = nlohmann::json::parse(file, nullptr, false);
+
+        if (index.is_discarded() || !index.is_object())
+        {
+            wxLogDebug("HTTP cache: ignoring unreadable index");
+            return;
+        }
+
+        fileCounter = index.value("counter", 0ull);
+
+        // stored oldest first, so inserting in order rebuilds the recency list
+        for (const auto &item : index.value("entries", nlohmann::json::array()))
+        {
+            Entry entry;
+            entry.file = item.value("file", "");
+            entry.etag = item.value("etag", "");
+            entry.lastModified = item.value("lastModified", "");
+            entry.size = item.value("size", size_t(0));
+
+            if (!entry.file.empty() && FileExists(entry))
+            {
+                entries.Put(item.value("url", ""), entry);
+            }
+        }
+    }
+
+    void SaveIndex()
+    {
+        if (!isUsable || !indexDirty)
+        {
+            return;
+        }
+
+        nlohmann::json list = nlohmann::json::array();
+
+        entries.ForEachOldestFirst([&list](const std::string &url, const Entry &entry)
+                                   { list.push_back({{"url", url},
+                                                     {"file", entry.file},
+                                                     {"etag", entry.etag},
+                                                     {"lastModified", entry.lastModified},
+                                                     {"size", entry.size}}); });
+
+        nlohmann::json index = {{"counter", fileCounter}, {"entries", list}};
+
+        const wxString temporary = IndexPath() + ".tmp";
+
+        {
+            std::ofstream file(temporary.fn_str(), std::ios::binary | std::ios::trunc);
+            file << index.dump();
+
+            if (!file)
+            {
+                return;
+            }
+        }
+
+        if (wxRenameFile(temporary, IndexPath()))
+        {
+            indexDirty = false;
+        }
+    }
+
+    wxString directory;
+    bool isUsable = false;
+
+    LruCache<std::string, Entry> entries;
+    bool indexDirty = false;
+    wxTimer saveTimer;
+    unsigned long long fileCounter = 0;
+
+    size_t hits = 0, stores = 0;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <utility>
+
+// Least-recently-used cache bounded by a byte budget rather than an entry count.
+// The cost of each value is reported by the size function given at construction.
+template <typename Key, typename Value>
+class LruCache
+{
+public:
+    using SizeFunction = std::function<size_t(const Value &)>;
+    using EvictionCallback = std::function<void(const Key &, const Value &)>;
+
+    struct Stats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t budgetBytes = 0;
+    };
+
+    LruCache(size_t budgetBytes, SizeFunction sizeOf)
+        : budgetBytes(budgetBytes), sizeOf(std::move(sizeOf))
+    {
+    }
+
+    // called for entries dropped to stay within the budget, not for Erase/Clear
+    void SetEvictionCallback(EvictionCallback callback)
+    {
+        onEvict = std::move(callback);
+    }
+
+    // returns nullptr on a miss; a hit makes the entry the most recently used one
+    const Value *Find(const Key &key)
+    {
+        auto it = index.find(key);
+
+        if (it == index.end())
+        {
+            misses++;
+            return nullptr;
+        }
+
+        hits++;
+        entries.splice(entries.begin(), entries, it->second);
+
+        return &it->second->value;
+    }
+
+    // lookup without touching the recency order or the counters
+    const Value *Peek(const Key &key) const
+    {
+        auto it = index.find(key);
+        return it == index.end() ? nullptr : &it->second->value;
+    }
+
+    bool Contains(const Key &key) const
+    {
+        return index.count(key) > 0;
+    }
+
+    void Put(const Key &key, Value value)
+    {
+        Erase(key);
+
+        const size_t size = sizeOf(value);
+
+        if (size > budgetBytes)
+        {
+            return;
+        }
+
+        entries.push_front({key, std::move(value), size});
+        index[key] = entries.begin();
+        bytes += size;
+
+        EvictToBudget();
+    }
+
+    bool Erase(const Key &key)
+    {
+        auto it = index.find(key);
+
+        if (it == index.end())
+        {
+            return false;
+        }
+
+        bytes -= it->second->size;
+        entries.erase(it->second);
+        index.erase(it);
+
+        return true;
+    }
+
+    void Clear()
+    {
+        entries.clear();
+        index.clear();
+        bytes = 0;
+    }
+
+    void SetBudget(size_t newBudgetBytes)
+    {
+        budgetBytes = newBudgetBytes;
+        EvictToBudget();
+    }
+
+    size_t GetBudget() const
+    {
+        return budgetBytes;
+    }
+
+    size_t GetBytes() const
+    {
+        return bytes;
+    }
+
+    template <typename F>
+    void ForEachOldestFirst(F &&visit) const
+    {
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+        {
+            visit(it->key, it->value);
+        }
+    }
+
+    Stats GetStats() const
+    {
+        Stats stats;
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.evictions = evictions;
+        stats.entries = entries.size();
+        stats.bytes = bytes;
+        stats.budgetBytes = budgetBytes;
+        return stats;
+    }
+
+private:
+    struct Entry
+    {
+        Key key;
+        Value value;
+        size_t size;
+    };
+
+    void EvictToBudget()
+    {
+        while (bytes > budgetBytes && !entries.empty())
+        {
+            Entry victim = std::move(entries.back());
+
+            bytes -= victim.size;
+            index.erase(victim.key);
+            entries.pop_back();
+
+            evictions++;
+
+            if (onEvict)
+            {
+                onEvict(victim.key, victim.value);
+            }
+        }
+    }
+
+    size_t budgetBytes;
+    SizeFunction sizeOf;
+    EvictionCallback onEvict;
+
+    std::list<Entry> entries;
+    std::unordered_map<Key, typename std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+
+    size_t hits = 0, misses = 0, evictions = 0;
+};
@@ -1,5 +1,7 @@
 #include <wx/wx.h>
+#include <wx/log.h>
 #include <wx/settings.h>
+#include <wx/srchctrl.h>
 
 #include <wx/webrequest.h>
 
@@ -7,10 +9,18 @@
 
 #include <vector>
 #include <memory>
+#include <optional>
 #include "product.h"
 
 #include "bitmapgallery.h"
 #include "bitmaploader.h"
+#include "httpcache.h"
+#include "catalogloader.h"
+#include "catalogstore.h"
+#include "catalogindex.h"
+#include "catalogsnapshot.h"
+#include "metrics.h"
+#include "scenariodriver.h"
 
 class MyApp : public wxApp
 {
@@ -20,15 +30,27 @@ public:
 class MyFrame : public wxFrame
 {
 public:
-    MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size);
+    MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size, const std::string &baseUrl, const std::string &scenario = {}, const wxString &metricsPath = {});
 
 private:
     void BuildUI();
-    void DownloadProducts();
+    void ShowPrevious();
+    void ShowNext();
+    void AddProducts(std::vector<Product> &&batch);
+    void SwapInCatalog();
 
-    void RefreshCurrentProduct();
+    void RefreshCurrentProduct(bool reloadImages = true);
+    std::vector<std::string> NeighbourImageUrls(int distance) const;
+    void LoadAhead();
+
+    void ApplySearch(const wxString &text);
+    int NavigationCount() const;
+    int ProductAt(int position) const;
 
     void OnClose(wxCloseEvent &event);
+    void OnIdle(wxIdleEvent &event);
+    void OnCharHook(wxKeyEvent &event);
+    void UpdateMetricsOverlay();
 
     BitmapGallery *bitmapView;
 
@@ -45,15 +67,46 @@ private:
     wxStaticText *ratingText;
 
     wxTextCtrl *descriptionField;
+    wxSearchCtrl *searchField;
+
+    CatalogStore catalog;
 
-    wxWebRequest request;
+    // Built in slices of IndexSliceProducts in idle time, so a large snapshot is
+    // on screen before it is searchable; a search finishes it on the spot.
+    CatalogIndex catalogIndex;
+    static constexpr size_t IndexSliceProducts = 1000;
 
-    std::vector<Product> products;
     int currentProductIndex = 0;
 
+    // While the catalog shown came from the snapshot, the network copy is built
+    // up here and swapped in once it has caught up.
+    std::unique_ptr<CatalogStore> incomingCatalog;
+
+    // Prev/Next walk positions in the search results, or the whole catalog
+    // without a search
+    std::optional<CatalogQuery> activeQuery;
+    std::vector<uint32_t> matches;
+    int currentPosition = 0;
+
+    static constexpr int PrefetchDistance = 2;
+
+    // declared before the loader, which keeps a pointer to it
+    std::unique_ptr<HttpCache> httpCache;
     std::unique_ptr<BitmapLoader> bitmapLoader;
 
-    bool quitRequested = false;
+    // after the bitmap loader, which the products it delivers are handed to
+    std::unique_ptr<CatalogLoader> catalogLoader;
+
+    // where the catalog comes from; also keys the snapshot
+    std::string baseUrl;
+
+    // only for --drive runs, which neither read nor write the snapshot
+    std::unique_ptr<ScenarioDriver> driver;
+
+    // --metrics writes the registry here on close; F12 shows it over the gallery
+    wxString metricsPath;
+    wxTimer metricsOverlayTimer;
+    static constexpr int MetricsOverlayIntervalMs = 500;
 };
 
 wxIMPLEMENT_APP(MyApp);
@@ -62,18 +115,101 @@ bool MyApp::OnInit()
 {
     wxInitAllImageHandlers(); // to read PNG
 
-    MyFrame *frame = new MyFrame("Hello World", wxDefaultPosition, wxDefaultSize);
+    // --base-url points the app at another server with the same API, e.g.
+    // tools/mockserver.py; --drive=<scenario> runs a scripted session against it
+    std::string baseUrl = CatalogLoader::DefaultBaseUrl;
+    std::string scenario;
+    wxString metricsPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        wxString value;
+
+        if (argv[i] == "--clear-cache")
+        {
+            HttpCache().Clear();
+        }
+        else if (argv[i].StartsWith("--base-url=", &value))
+        {
+            baseUrl = value.utf8_string();
+        }
+        else if (argv[i].StartsWith("--drive=", &value))
+        {
+            scenario = value.utf8_string();
+
+            if (!ScenarioDriver::Scenario(scenario))
+            {
+                wxLogError("Unknown scenario \"%s\" (rapid, midflight, close or all)", value);
+                return false;
+            }
+        }
+        else if (argv[i].StartsWith("--metrics=", &value))
+        {
+            metricsPath = value;
+        }
+    }
+
+    if (!scenario.empty())
+    {
+        // errors would be modal dialogs, which nobody is there to dismiss
+        delete wxLog::SetActiveTarget(new wxLogStderr());
+    }
+
+    MyFrame *frame = new MyFrame("Hello World", wxDefaultPosition, wxDefaultSize, baseUrl, scenario, metricsPath);
     frame->Show(true);
     return true;
 }
 
-MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size)
-    : wxFrame(NULL, wxID_ANY, title, pos, size)
+MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size, const std::string &baseUrl, const std::string &scenario, const wxString &metricsPath)
+    : wxFrame(NULL, wxID_ANY, title, pos, size), baseUrl(baseUrl), metricsPath(metricsPath)
 {
     this->Bind(wxEVT_CLOSE_WINDOW, &MyFrame::OnClose, this);
+    this->Bind(wxEVT_CHAR_HOOK, &MyFrame::OnCharHook, this);
+    this->Bind(wxEVT_IDLE, &MyFrame::OnIdle, this);
+
+    metricsOverlayTimer.SetOwner(this);
+    this->Bind(wxEVT_TIMER, [this](wxTimerEvent &)
+               { UpdateMetricsOverlay(); });
+
+    httpCache = std::make_unique<HttpCache>();
 
     BuildUI();
-    DownloadProducts();
+
+    catalogLoader = std::make_unique<CatalogLoader>(
+        httpCache.get(), [this](std::vector<Product> &&batch)
+        { AddProducts(std::move(batch)); },
+        baseUrl);
+
+    if (!scenario.empty())
+    {
+        ScenarioDriver::Actions actions;
+        actions.ready = [this]()
+        { return !catalog.Empty(); };
+        actions.next = [this]()
+        { ShowNext(); };
+        actions.previous = [this]()
+        { ShowPrevious(); };
+        actions.close = [this]()
+        { Close(); };
+
+        driver = std::make_unique<ScenarioDriver>(scenario, *ScenarioDriver::Scenario(scenario), actions, bitmapLoader.get());
+    }
+    else if (auto snapshot = CatalogSnapshot::Load(CatalogSnapshot::DefaultPath(), baseUrl))
+    {
+        wxLogDebug("Showing %zu products from the snapshot", snapshot->Size());
+
+        catalog = std::move(*snapshot);
+        incomingCatalog = std::make_unique<CatalogStore>();
+    }
+
+    if (!catalog.Empty())
+    {
+        RefreshCurrentProduct();
+    }
+    else
+    {
+        catalogLoader->LoadAheadOf(0);
+    }
 }
 
 void MyFrame::BuildUI()
@@ -83,6 +219,10 @@ void MyFrame::BuildUI()
     wxPanel *panel = new wxPanel(this, wxID_ANY);
     auto sizer = new wxBoxSizer(wxVERTICAL);
 
+    searchField = new wxSearchCtrl(panel, wxID_ANY, "", wxDefaultPosition, wxDefaultSize);
+    searchField->SetDescriptiveText("category=laptops AND price<1000 AND text:ssd");
+    searchField->ShowCancelButton(true);
+
     bitmapView = new BitmapGallery(panel);
     bitmapView->scaling = BitmapScaling::FillWidth;
 
@@ -122,6 +262,7 @@ void MyFrame::BuildUI()
     navigationSizer->Add(prevButton, 0, wxALL, FromDIP(5));
     navigationSizer->Add(nextButton, 0, wxALL, FromDIP(5));
 
+    sizer->Add(searchField, 0, wxEXPAND | wxALL, FromDIP(10));
     sizer->Add(bitmapView, 2, wxEXPAND | wxBOTTOM, FromDIP(10));
     sizer->Add(titleText, 0, wxALIGN_CENTER | wxALL, FromDIP(10));
     sizer->Add(gridSizer, 0, wxEXPAND | wxALL, FromDIP(10));
@@ -140,101 +281,287 @@ void MyFrame::BuildUI()
     this->descriptionField->SetBackgroundColour(this->GetBackgroundColour());
 
     prevButton->Bind(wxEVT_BUTTON, [this](wxCommandEvent &evt)
-                     {
-                         if (this->currentProductIndex > 0)
-                         {
-                             this->currentProductIndex--;
-                             this->RefreshCurrentProduct();
-                         } });
+                     { this->ShowPrevious(); });
 
     nextButton->Bind(wxEVT_BUTTON, [this](wxCommandEvent &evt)
-                     {
-                         if (this->currentProductIndex < (int)this->products.size() - 1)
-                         {
-                             this->currentProductIndex++;
-                             this->RefreshCurrentProduct();
-                         } });
+                     { this->ShowNext(); });
+
+    searchField->Bind(wxEVT_SEARCHCTRL_SEARCH_BTN, [this](wxCommandEvent &evt)
+                      { this->ApplySearch(evt.GetString()); });
+    searchField->Bind(wxEVT_SEARCHCTRL_CANCEL_BTN, [this](wxCommandEvent &evt)
+                      {
+                          this->searchField->Clear();
+                          this->ApplySearch(""); });
 
-    bitmapLoader = std::make_unique<BitmapLoader>(bitmapView);
+    bitmapLoader = std::make_unique<BitmapLoader>(bitmapView, httpCache.get());
 }
 
-void MyFrame::RefreshCurrentProduct()
+void MyFrame::ShowPrevious()
 {
-    auto product = this->products[this->currentProductIndex];
+    if (this->currentPosition > 0)
+    {
+        this->currentPosition--;
+        this->currentProductIndex = this->ProductAt(this->currentPosition);
+        this->RefreshCurrentProduct();
+    }
+}
 
-    this->titleText->SetLabel(product.title);
-    this->priceText->SetLabel(wxString::Format("$%.2Lf", product.price));
-    this->brandText->SetLabel(product.brand);
-    this->categoryText->SetLabel(product.category);
+void MyFrame::ShowNext()
+{
+    if (this->currentPosition < this->NavigationCount() - 1)
+    {
+        this->currentPosition++;
+        this->currentProductIndex = this->ProductAt(this->currentPosition);
+        this->RefreshCurrentProduct();
+    }
+    else
+    {
+        // at the end of what has loaded: make sure the next page is on its way
+        this->LoadAhead();
+    }
+}
+
+static wxString ToWxString(std::string_view text)
+{
+    return wxString::FromUTF8(text.data(), text.size());
+}
+
+void MyFrame::RefreshCurrentProduct(bool reloadImages)
+{
+    const ProductView product = this->catalog.Get(this->currentProductIndex);
+
+    this->titleText->SetLabel(ToWxString(product.title));
+    this->priceText->SetLabel(wxString::Format("$%.2f", product.price));
+    this->brandText->SetLabel(ToWxString(product.brand));
+    this->categoryText->SetLabel(ToWxString(product.category));
     this->ratingText->SetLabel(wxString::Format("%.1f", product.rating));
-    this->descriptionField->SetValue(product.description);
+    this->descriptionField->SetValue(ToWxString(product.description));
 
-    bitmapLoader->LoadBitmaps(product.imageUrls);
+    if (reloadImages)
+    {
+        bitmapLoader->LoadBitmaps(product.ImageUrls(), product.ThumbnailUrl());
+    }
+
+    bitmapLoader->Prefetch(NeighbourImageUrls(PrefetchDistance));
+
+    LoadAhead();
 
     Layout();
 }
 
-void MyFrame::DownloadProducts()
+// images of the products within `distance` of the current one, nearest first,
+// alternating next/previous since paging forward is the common case; all the
+// thumbnails come before any full image, so paging shows something right away
+std::vector<std::string> MyFrame::NeighbourImageUrls(int distance) const
+{
+    std::vector<int> neighbours;
+
+    for (int offset = 1; offset <= distance; offset++)
+    {
+        for (int position : {currentPosition + offset, currentPosition - offset})
+        {
+            if (position >= 0 && position < NavigationCount())
+            {
+                neighbours.push_back(ProductAt(position));
+            }
+        }
+    }
+
+    std::vector<std::string> urls;
+
+    for (int index : neighbours)
+    {
+        auto thumbnailUrl = catalog.ThumbnailUrl(index);
+
+        if (!thumbnailUrl.empty())
+        {
+            urls.push_back(std::move(thumbnailUrl));
+        }
+    }
+
+    for (int index : neighbours)
+    {
+        const auto imageUrls = catalog.ImageUrls(index);
+        urls.insert(urls.end(), imageUrls.begin(), imageUrls.end());
+    }
+
+    return urls;
+}
+
+// Keeps the catalog loaded a little ahead of the user. While searching, that
+// means ahead of the last match: sparse results keep pulling in pages until
+// there are enough matches past the current one, or the catalog runs out.
+void MyFrame::LoadAhead()
+{
+    if (incomingCatalog)
+    {
+        // refreshing the snapshot: everything it holds, then the usual distance
+        catalogLoader->LoadAheadOf(std::max<size_t>(catalog.Size(), currentProductIndex));
+    }
+    else if (!activeQuery)
+    {
+        catalogLoader->LoadAheadOf(currentProductIndex);
+    }
+    else if (currentPosition + (int)CatalogLoader::LoadAheadDistance >= NavigationCount())
+    {
+        catalogLoader->LoadAheadOf(catalog.Size());
+    }
+}
+
+int MyFrame::NavigationCount() const
+{
+    return activeQuery ? (int)matches.size() : (int)catalog.Size();
+}
+
+int MyFrame::ProductAt(int position) const
+{
+    return activeQuery ? (int)matches[position] : position;
+}
+
+void MyFrame::ApplySearch(const wxString &text)
+{
+    std::string error;
+    auto query = CatalogQuery::Parse(text.utf8_string(), &error);
+
+    if (!query)
+    {
+        wxBell();
+        searchField->SetToolTip(wxString::FromUTF8(error));
+        return;
+    }
+
+    searchField->UnsetToolTip();
+
+    if (query->Empty())
+    {
+        // back to the whole catalog, staying on the current product
+        activeQuery.reset();
+        matches.clear();
+        currentPosition = currentProductIndex;
+
+        if (!catalog.Empty())
+        {
+            bitmapLoader->Prefetch(NeighbourImageUrls(PrefetchDistance));
+        }
+
+        LoadAhead();
+        return;
+    }
+
+    activeQuery = std::move(query);
+
+    // the results must cover everything loaded, not what idle time got to
+    catalogIndex.Update(catalog);
+    matches = catalogIndex.Run(*activeQuery, catalog);
+    currentPosition = 0;
+
+    wxLogDebug("Search: %zu matches in %zu products", matches.size(), catalog.Size());
+
+    if (matches.empty())
+    {
+        // nothing loaded so far matches; the first match to arrive is shown
+        wxBell();
+        LoadAhead();
+        return;
+    }
+
+    currentProductIndex = matches.front();
+    RefreshCurrentProduct();
+}
+
+void MyFrame::AddProducts(std::vector<Product> &&batch)
 {
-    static constexpr auto Url = "https://dummyjson.com/products/";
+    if (incomingCatalog)
+    {
+        incomingCatalog->Append(std::move(batch));
+
+        // the feed may have shrunk since the snapshot was taken
+        const size_t caughtUp = std::min(catalog.Size(), catalogLoader->GetTotal().value_or(catalog.Size()));
+
+        if (incomingCatalog->Size() >= caughtUp)
+        {
+            SwapInCatalog();
+        }
+
+        return;
+    }
 
-    request = wxWebSession::GetDefault().CreateRequest(this, Url);
+    const bool wasEmpty = catalog.Empty();
+    const int previousCount = NavigationCount();
 
-    if (!request.IsOk())
+    catalog.Append(std::move(batch));
+
+    if (activeQuery)
     {
-        wxLogError("Failed to create request");
+        // new products only ever append matches, so positions stay put
+        catalogIndex.Update(catalog);
+        matches = catalogIndex.Run(*activeQuery, catalog);
+    }
+
+    if ((wasEmpty || previousCount == 0) && NavigationCount() > 0)
+    {
+        this->currentPosition = 0;
+        this->currentProductIndex = ProductAt(0);
+        this->RefreshCurrentProduct();
+    }
+    else if (currentPosition + PrefetchDistance >= previousCount && NavigationCount() > previousCount)
+    {
+        // neighbours that did not exist yet when the current product was shown
+        bitmapLoader->Prefetch(NeighbourImageUrls(PrefetchDistance));
+    }
+
+    if (activeQuery)
+    {
+        LoadAhead();
+    }
+}
+
+// Replaces the snapshot catalog with the network copy in one step, keeping the
+// user on the same product where it still exists.
+void MyFrame::SwapInCatalog()
+{
+    const std::vector<std::string> shownUrls = catalog.ImageUrls(currentProductIndex);
+
+    catalog = std::move(*incomingCatalog);
+    incomingCatalog.reset();
+
+    catalogIndex = CatalogIndex();
+
+    wxLogDebug("Swapped in %zu products from the network", catalog.Size());
+
+    if (activeQuery)
+    {
+        catalogIndex.Update(catalog);
+        matches = catalogIndex.Run(*activeQuery, catalog);
+        currentPosition = std::lower_bound(matches.begin(), matches.end(), (uint32_t)currentProductIndex) - matches.begin();
+    }
+    else
+    {
+        currentPosition = currentProductIndex;
+    }
+
+    currentPosition = std::max(0, std::min(currentPosition, NavigationCount() - 1));
+
+    if (NavigationCount() == 0)
+    {
+        LoadAhead();
         return;
     }
 
-    this->Bind(wxEVT_WEBREQUEST_STATE, [this](wxWebRequestEvent &evt)
-               {
-                   if (evt.GetState() == wxWebRequest::State_Completed)
-                   {
-                       auto response = evt.GetResponse();
-                       if (response.GetStatus() == 200)
-                       {
-                           auto productsJson = nlohmann::json::parse(response.AsString());
-                           for (auto &object : productsJson["products"])
-                           {
-                               Product p{
-                                   object.value("title", "Unknown Title"),
-                                   object.value("price", 0.0),
-                                   object.value("brand", "Unknown Brand"),
-                                   object.value("category", "Unknown Category"),
-                                   object.value("rating", 0.0),
-                                   object.value("description", ""),
-                                   object.value("images", nlohmann::json::array())
-                               };
-
-                               this->products.push_back(p);
-                           }
-
-                           this->currentProductIndex = 0;
-                           this->RefreshCurrentProduct();
-                       }
-                       else
-                       {
-                           wxLogError("Failed to download products");
-                       }
-                   }
-
-                   if (quitRequested && evt.GetState() == wxWebRequest::State_Cancelled)
-                   {
-                       this->Close();
-                   } });
-
-    request.Start();
+    currentProductIndex = ProductAt(currentPosition);
+
+    // only restart the gallery if the images actually changed
+    RefreshCurrentProduct(catalog.ImageUrls(currentProductIndex) != shownUrls);
 }
 
 void MyFrame::OnClose(wxCloseEvent &evt)
 {
-    if (request.IsOk() && request.GetState() == wxWebRequest::State_Active)
+    if (catalogLoader && !catalogLoader->IsIdle())
     {
-        quitRequested = true;
         this->Hide();
         this->CallAfter([this]()
-                        { request.Cancel(); });
-
+                        { catalogLoader->CancelAll([this]()
+                                                   { this->Close(); }); });
         evt.Veto();
     }
     else if (bitmapLoader && !bitmapLoader->IsIdle())
@@ -247,6 +574,77 @@ void MyFrame::OnClose(wxCloseEvent &evt)
     }
     else
     {
+        metricsOverlayTimer.Stop();
+
+        if (!metricsPath.empty() && !Metrics::Get().WriteJson(metricsPath))
+        {
+            wxLogDebug("Failed to write metrics to %s", metricsPath);
+        }
+
+        if (driver)
+        {
+            driver->Finish();
+        }
+        // only a catalog fresh from the network is worth keeping for next time
+        else if (!incomingCatalog && !catalog.Empty())
+        {
+            CatalogSnapshot::Write(catalog, baseUrl, CatalogSnapshot::DefaultPath());
+        }
+
         evt.Skip();
     }
 }
+
+void MyFrame::OnIdle(wxIdleEvent &event)
+{
+    event.Skip();
+
+    if (catalogIndex.Size() < catalog.Size())
+    {
+        catalogIndex.Update(catalog, IndexSliceProducts);
+
+        if (catalogIndex.Size() < catalog.Size())
+        {
+            event.RequestMore();
+        }
+    }
+}
+
+void MyFrame::OnCharHook(wxKeyEvent &event)
+{
+#ifdef GALLERY_PROFILER
+    if (event.GetKeyCode() == WXK_F11)
+    {
+        bitmapView->ToggleFrameProfiler();
+        return;
+    }
+#endif
+
+    if (event.GetKeyCode() != WXK_F12)
+    {
+        event.Skip();
+        return;
+    }
+
+    if (metricsOverlayTimer.IsRunning())
+    {
+        metricsOverlayTimer.Stop();
+        bitmapView->SetOverlayText("");
+    }
+    else
+    {
+        metricsOverlayTimer.Start(MetricsOverlayIntervalMs);
+        UpdateMetricsOverlay();
+    }
+}
+
+void MyFrame::UpdateMetricsOverlay()
+{
+    const wxString summary = Metrics::Get().Summary();
+
+    wxString text = wxString::Format("%-26s %6s  %8s %8s %8s\n", "(ms, bytes)", "count", "p50", "p95", "p99");
+    text += summary.empty() ? wxString("no requests yet\n") : summary;
+    text += wxString::Format("%-26s %6d", "gallery repaints/s", bitmapView->GetRepaintsPerSecond());
+
+    bitmapView->SetOverlayText(text);
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <wx/wx.h>
+#include <wx/webrequest.h>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+
+#if defined(_WIN32)
+#include <wx/msw/wrapwin.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Distribution of non-negative values (milliseconds, bytes) in fixed log-scale
+// buckets, each 2^(1/4) wide, about 19%. Recording is a log and an increment,
+// with no allocation, so histograms can stay on in production; percentiles are
+// accurate to within a bucket.
+class Histogram
+{
+public:
+    static constexpr int BucketsPerOctave = 4;
+    static constexpr double Smallest = 1e-3; // values below share the first bucket
+    static constexpr size_t BucketCount = 40 * BucketsPerOctave;
+
+    void Record(double value)
+    {
+        value = std::max(0.0, value);
+
+        buckets[BucketOf(value)]++;
+        count++;
+        sum += value;
+        min = count == 1 ? value : std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    size_t Count() const
+    {
+        return count;
+    }
+
+    double Mean() const
+    {
+        return count > 0 ? sum / count : 0;
+    }
+
+    // upper bound of the bucket holding the p-th value, clamped to the largest seen
+    double Percentile(double p) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        const size_t rank = static_cast<size_t>(std::ceil(p / 100 * count));
+        size_t seen = 0;
+
+        for (size_t i = 0; i < BucketCount; i++)
+        {
+            seen += buckets[i];
+
+            if (seen >= std::max<size_t>(1, rank))
+            {
+                return std::clamp(UpperBound(i), min, max);
+            }
+        }
+
+        return max;
+    }
+
+    nlohmann::json ToJson() const
+    {
+        return {{"count", count}, {"mean", Mean()}, {"min", min}, {"p50", Percentile(50)}, {"p95", Percentile(95)}, {"p99", Percentile(99)}, {"max", max}};
+    }
+
+private:
+    static size_t BucketOf(double value)
+    {
+        if (value <= Smallest)
+        {
+            return 0;
+        }
+
+        const int bucket = static_cast<int>(std::ceil(std::log2(value / Smallest) * BucketsPerOctave));
+        return std::min<size_t>(bucket, BucketCount - 1);
+    }
+
+    static double UpperBound(size_t bucket)
+    {
+        return Smallest * std::exp2(static_cast<double>(bucket) / BucketsPerOctave);
+    }
+
+    std::array<uint32_t, BucketCount> buckets{};
+    size_t count = 0;
+    double sum = 0, min = 0, max = 0;
+};
+
+// Where the time of one request went, from being wanted to being on screen.
+// Stages that did not happen (a failed download, a cell never scrolled into
+// view, a catalog page, which is parsed rather than decoded) stay empty.
+struct RequestTrace
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::string kind; // "image" or "catalog"
+    std::string url;
+
+    Clock::time_point queued;
+    std::optional<Clock::time_point> started, firstByte, completed;
+    std::optional<Clock::time_point> decodeStart, decodeEnd; // parse, for a catalog page
+    std::optional<Clock::time_point> bitmapReady, firstPaint;
+
+    size_t bytes = 0;
+    std::optional<wxWebRequest::State> state;
+};
+
+// In-process registry of histograms, counters and the most recent request
+// traces. GUI thread only: workers take their timestamps themselves and hand
+// them back with the result, as they do with everything else.
+class Metrics
+{
+public:
+    static constexpr size_t RecentTraceCount = 200;
+
+    static Metrics &Get()
+    {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    void Record(const std::string &name, double value)
+    {
+        histograms[name].Record(value);
+    }
+
+    void Count(const std::string &name, size_t amount = 1)
+    {
+        counters[name] += amount;
+    }
+
+    const Histogram *Find(const std::string &name) const
+    {
+        auto it = histograms.find(name);
+        return it != histograms.end() ? &it->second : nullptr;
+    }
+
+    // Records the stages of a trace whose request is done with; each stage goes
+    // into "<kind>.<stage>_ms".
+    void Finish(const RequestTrace &trace)
+    {
+        const std::string prefix = trace.kind + ".";
+
+        auto stage = [&](const char *name, const auto &from, const auto &to)
+        {
+            if (from && to)
+            {
+                Record(prefix + name, std::chrono::duration<double, std::milli>(*to - *from).count());
+            }
+        };
+
+        const std::optional<RequestTrace::Clock::time_point> queued = trace.queued;
+
+        stage("queue_ms", queued, trace.started);
+        stage("first_byte_ms", trace.started, trace.firstByte);
+        stage("download_ms", trace.started, trace.completed);
+        stage("decode_wait_ms", trace.completed, trace.decodeStart);
+        stage("decode_ms", trace.decodeStart, trace.decodeEnd);
+        stage("convert_ms", trace.decodeEnd, trace.bitmapReady);
+        stage("paint_wait_ms", trace.bitmapReady, trace.firstPaint);
+        stage("total_ms", queued, trace.firstPaint ? trace.firstPaint : trace.bitmapReady ? trace.bitmapReady
+                                                                                          : trace.decodeEnd);
+
+        if (trace.started)
+        {
+            Record(prefix + "bytes", trace.bytes);
+            Count(prefix + "bytes", trace.bytes);
+        }
+
+        Count(prefix + "state." + (trace.state ? StateName(*trace.state) : "none"));
+
+        recentTraces.push_back(trace);
+
+        if (recentTraces.size() > RecentTraceCount)
+        {
+            recentTraces.pop_front();
+        }
+    }
+
+    nlohmann::json ToJson() const
+    {
+        nlohmann::json result = {{"histograms", nlohmann::json::object()}, {"counters", counters}, {"recent", nlohmann::json::array()}};
+
+        for (const auto &[name, histogram] : histograms)
+        {
+            result["histograms"][name] = histogram.ToJson();
+        }
+
+        for (const auto &trace : recentTraces)
+        {
+            result["recent"].push_back(TraceToJson(trace));
+        }
+
+        return result;
+    }
+
+    bool WriteJson(const wxString &path) const
+    {
+        std::ofstream file(path.fn_str(), std::ios::trunc);
+        file << ToJson().dump(2) << '\n';
+
+        return static_cast<bool>(file);
+    }
+
+    // one line per histogram: name, count and p50/p95/p99
+    wxString Summary() const
+    {
+        wxString text;
+
+        for (const auto &[name, histogram] : histograms)
+        {
+            text += wxString::Format("%-26s %6zu  %8.1f %8.1f %8.1f\n", name, histogram.Count(), histogram.Percentile(50), histogram.Percentile(95), histogram.Percentile(99));
+        }
+
+        return text;
+    }
+
+    // peak resident memory of the whole process, 0 where unknown
+    static size_t PeakResidentBytes()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        return K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+        struct rusage usage;
+
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+
+#if defined(__APPLE__)
+        return static_cast<size_t>(usage.ru_maxrss);
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    static std::string StateName(wxWebRequest::State state)
+    {
+        switch (state)
+        {
+        case wxWebRequest::State_Idle:
+            return "idle";
+        case wxWebRequest::State_Active:
+            return "active";
+        case wxWebRequest::State_Completed:
+            return "completed";
+        case wxWebRequest::State_Unauthorized:
+            return "unauthorized";
+        case wxWebRequest::State_Failed:
+            return "failed";
+        case wxWebRequest::State_Cancelled:
+            return "cancelled";
+        default:
+            return "unknown";
+        }
+    }
+
+private:
+    Metrics() = default;
+
+    nlohmann::json TraceToJson(const RequestTrace &trace) const
+    {
+        // stage times relative to when the request was queued
+        auto offset = [&](const std::optional<RequestTrace::Clock::time_point> &point)
+        {
+            return point ? nlohmann::json(std::chrono::duration<double, std::milli>(*point - trace.queued).count()) : nlohmann::json();
+        };
+
+        return {{"kind", trace.kind},
+                {"url", trace.url},
+                {"started_ms", offset(trace.started)},
+                {"first_byte_ms", offset(trace.firstByte)},
+                {"completed_ms", offset(trace.completed)},
+                {"decode_start_ms", offset(trace.decodeStart)},
+                {"decode_end_ms", offset(trace.decodeEnd)},
+                {"bitmap_ready_ms", offset(trace.bitmapReady)},
+                {"first_paint_ms", offset(trace.firstPaint)},
+                {"bytes", trace.bytes},
+                {"state", trace.state ? StateName(*trace.state) : "none"}};
+    }
+
+    std::map<std::string, Histogram> histograms;
+    std::map<std::string, size_t> counters;
+    std::deque<RequestTrace> recentTraces;
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <wx/wx.h>
+#include <wx/rawbmp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Pixel memory for one image, laid out the way wxImage keeps it: packed RGB,
+// then an optional alpha plane. Comes from a PixelBufferPool and goes back to
+// it when the last reference is dropped.
+class PixelBuffer
+{
+public:
+    int GetWidth() const
+    {
+        return width;
+    }
+
+    int GetHeight() const
+    {
+        return height;
+    }
+
+    unsigned char *Rgb() const
+    {
+        return memory.get();
+    }
+
+    // null without an alpha plane
+    unsigned char *Alpha() const
+    {
+        return hasAlpha ? memory.get() + static_cast<size_t>(width) * height * 3 : nullptr;
+    }
+
+    size_t GetCapacity() const
+    {
+        return capacity;
+    }
+
+    // A wxImage over this memory, without copying or owning it; it must not
+    // outlive the buffer.
+    wxImage AsImage() const
+    {
+        return hasAlpha ? wxImage(width, height, Rgb(), Alpha(), true) : wxImage(width, height, Rgb(), true);
+    }
+
+    // Writes the pixels straight into a native bitmap through raw access, in
+    // place of wxBitmap(wxImage), which goes through a converted temporary on
+    // some ports. wx has no way to adopt foreign memory as a bitmap, so this one
+    // copy is as close to a hand-off as it gets. Alpha stays with wx, which
+    // knows whether the port wants it premultiplied.
+    wxBitmap ToBitmap() const
+    {
+        if (hasAlpha)
+        {
+            return wxBitmap(AsImage());
+        }
+
+        wxBitmap bitmap(width, height, 24);
+        wxNativePixelData data(bitmap);
+
+        if (!data)
+        {
+            return wxBitmap(AsImage());
+        }
+
+        wxNativePixelData::Iterator row(data);
+        const unsigned char *source = Rgb();
+
+        for (int y = 0; y < height; y++)
+        {
+            wxNativePixelData::Iterator pixel = row;
+
+            for (int x = 0; x < width; x++, ++pixel)
+            {
+                pixel.Red() = *source++;
+                pixel.Green() = *source++;
+                pixel.Blue() = *source++;
+            }
+
+            row.OffsetY(data, 1);
+        }
+
+        return bitmap;
+    }
+
+private:
+    friend class PixelBufferPool;
+
+    std::unique_ptr<unsigned char[]> memory;
+    size_t capacity = 0;
+
+    int width = 0, height = 0;
+    bool hasAlpha = false;
+};
+
+// Reuses image buffers across images and batches instead of allocating a fresh
+// one per image: the full-size output of the JPEG and PNG decoders as well as
+// the downscaled copies. Formats left to wx still decode into a wxImage of
+// their own, since wx decoders cannot write into given memory. Buffers are
+// binned by size class (powers of two from MinClassBytes), so an image can take
+// any free buffer of its class. Up to retainBytes of free buffers are kept;
+// beyond that they are freed.
+//
+// Acquire and release are thread-safe: decode workers take buffers and the GUI
+// thread drops them after converting to a bitmap. Create it with make_shared;
+// buffers still out when the pool goes away are simply freed.
+class PixelBufferPool : public std::enable_shared_from_this<PixelBufferPool>
+{
+public:
+    static constexpr size_t MinClassBytes = 64 * 1024;
+    static constexpr size_t DefaultRetainBytes = 32 * 1024 * 1024;
+
+    struct Stats
+    {
+        size_t acquired = 0;
+        size_t allocated = 0; // acquisitions no free buffer could serve
+        size_t retainedBytes = 0;
+        size_t released = 0; // freed because the pool was full
+    };
+
+    explicit PixelBufferPool(size_t retainBytes = DefaultRetainBytes) : retainBytes(retainBytes)
+    {
+    }
+
+    std::shared_ptr<PixelBuffer> Acquire(int width, int height, bool alpha)
+    {
+        const size_t bytes = static_cast<size_t>(width) * height * (alpha ? 4 : 3);
+        const size_t sizeClass = SizeClass(bytes);
+
+        std::unique_ptr<PixelBuffer> buffer;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.acquired++;
+
+            auto &bin = freeBuffers[sizeClass];
+
+            if (!bin.empty())
+            {
+                buffer = std::move(bin.back());
+                bin.pop_back();
+                stats.retainedBytes -= buffer->capacity;
+            }
+            else
+            {
+                stats.allocated++;
+            }
+        }
+
+        if (!buffer)
+        {
+            buffer = std::make_unique<PixelBuffer>();
+            buffer->memory.reset(new unsigned char[sizeClass]);
+            buffer->capacity = sizeClass;
+        }
+
+        buffer->width = width;
+        buffer->height = height;
+        buffer->hasAlpha = alpha;
+
+        std::weak_ptr<PixelBufferPool> pool = weak_from_this();
+
+        return std::shared_ptr<PixelBuffer>(buffer.release(), [pool](PixelBuffer *released)
+                                            {
+                                                if (auto owner = pool.lock())
+                                                {
+                                                    owner->Release(std::unique_ptr<PixelBuffer>(released));
+                                                }
+                                                else
+                                                {
+                                                    delete released;
+                                                } });
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    static size_t SizeClass(size_t bytes)
+    {
+        size_t sizeClass = MinClassBytes;
+
+        while (sizeClass < bytes)
+        {
+            sizeClass *= 2;
+        }
+
+        return sizeClass;
+    }
+
+    void Release(std::unique_ptr<PixelBuffer> buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (stats.retainedBytes + buffer->capacity > retainBytes)
+        {
+            stats.released++;
+            return;
+        }
+
+        stats.retainedBytes += buffer->capacity;
+        freeBuffers[buffer->capacity].push_back(std::move(buffer));
+    }
+
+    size_t retainBytes;
+
+    mutable std::mutex mutex;
+    std::map<size_t, std::vector<std::unique_ptr<PixelBuffer>>> freeBuffers;
+    Stats stats;
+};
+
+// Box-filter downscale of `source` into `target`, which sets the size: every
+// target pixel is the mean of the source pixels its area covers. Does the job
+// of wxImage::Rescale with wxIMAGE_QUALITY_HIGH for shrinking, but writes into
+// a pooled buffer instead of allocating the result.
+//
+// With alpha, colours are averaged weighted by it, so the colour of fully
+// transparent pixels (usually black in the product PNGs) does not bleed into
+// the visible edges as a dark fringe.
+inline void DownscaleInto(const unsigned char *rgb, const unsigned char *alpha, int sourceW, int sourceH, PixelBuffer &target)
+{
+    const int targetW = target.GetWidth(), targetH = target.GetHeight();
+
+    unsigned char *outRgb = target.Rgb();
+    unsigned char *outAlpha = target.Alpha();
+
+    // per-thread scratch, so the decode workers do not allocate per image
+    thread_local std::vector<int> columns;
+    thread_local std::vector<uint64_t> sums;
+
+    columns.resize(targetW + 1);
+
+    for (int x = 0; x <= targetW; x++)
+    {
+        columns[x] = static_cast<int>(static_cast<int64_t>(x) * sourceW / targetW);
+    }
+
+    sums.resize(static_cast<size_t>(targetW) * 4);
+
+    for (int ty = 0; ty < targetH; ty++)
+    {
+        const int y0 = static_cast<int>(static_cast<int64_t>(ty) * sourceH / targetH);
+        const int y1 = std::max(y0 + 1, static_cast<int>(static_cast<int64_t>(ty + 1) * sourceH / targetH));
+
+        std::fill(sums.begin(), sums.end(), 0);
+
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *sourceRow = rgb + static_cast<size_t>(y) * sourceW * 3;
+            const unsigned char *alphaRow = alpha ? alpha + static_cast<size_t>(y) * sourceW : nullptr;
+
+            for (int tx = 0; tx < targetW; tx++)
+            {
+                uint64_t *sum = &sums[tx * 4];
+                const int x1 = std::max(columns[tx] + 1, columns[tx + 1]);
+                uint64_t r = 0, g = 0, b = 0, a = 0;
+
+                if (alphaRow)
+                {
+                    for (int x = columns[tx]; x < x1; x++)
+                    {
+                        const uint32_t weight = alphaRow[x];
+
+                        r += sourceRow[x * 3] * weight;
+                        g += sourceRow[x * 3 + 1] * weight;
+                        b += sourceRow[x * 3 + 2] * weight;
+                        a += weight;
+                    }
+                }
+                else
+                {
+                    for (int x = columns[tx]; x < x1; x++)
+                    {
+                        r += sourceRow[x * 3];
+                        g += sourceRow[x * 3 + 1];
+                        b += sourceRow[x * 3 + 2];
+                    }
+                }
+
+                sum[0] += r;
+                sum[1] += g;
+                sum[2] += b;
+                sum[3] += a;
+            }
+        }
+
+        for (int tx = 0; tx < targetW; tx++)
+        {
+            const uint64_t *sum = &sums[tx * 4];
+            const uint64_t count = static_cast<uint64_t>(y1 - y0) * std::max(1, columns[tx + 1] - columns[tx]);
+
+            // colours are divided by the weight they were summed with
+            const uint64_t divisor = alpha ? sum[3] : count;
+
+            for (int channel = 0; channel < 3; channel++)
+            {
+                *outRgb++ = divisor ? static_cast<unsigned char>((sum[channel] + divisor / 2) / divisor) : 0;
+            }
+
+            if (outAlpha)
+            {
+                *outAlpha++ = static_cast<unsigned char>((sum[3] + count / 2) / count);
+            }
+        }
+    }
+}
+
+inline void DownscaleInto(const wxImage &source, PixelBuffer &target)
+{
+    DownscaleInto(source.GetData(), source.HasAlpha() ? source.GetAlpha() : nullptr, source.GetWidth(), source.GetHeight(), target);
+}
@@ -7,11 +7,12 @@
 struct Product
 {
     std::string title;
-    long double price;
+    double price;
     std::string brand;
     std::string category;
     double rating;
     std::string description;
 
     std::vector<std::string> imageUrls;
+    std::string thumbnailUrl;
 };
\ No newline at end of file
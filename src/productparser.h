@@ -0,0 +1,239 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <functional>
+#include <istream>
+#include <string>
+#include <utility>
+
+#include "product.h"
+
+// Streaming parser for the products payload ({"products": [{...}, ...], ...}).
+// Built on nlohmann's SAX interface: fields are written straight into a Product
+// as they are read, and each product is handed out as soon as its object closes,
+// without building a DOM or copying the body into a string first.
+class ProductParser
+{
+public:
+    // return false to stop parsing
+    using ProductCallback = std::function<bool(Product &&product)>;
+
+    // the paging fields next to the product array
+    struct PageInfo
+    {
+        size_t total = 0;
+        size_t skip = 0;
+        size_t limit = 0;
+    };
+
+    // returns false on malformed input or when the callback stopped the parse
+    static bool Parse(const unsigned char *begin, const unsigned char *end, ProductCallback onProduct, PageInfo *pageInfo = nullptr)
+    {
+        ProductParser parser(std::move(onProduct));
+        const bool ok = nlohmann::json::sax_parse(begin, end, &parser) && !parser.stopped;
+
+        if (pageInfo)
+        {
+            *pageInfo = parser.pageInfo;
+        }
+
+        return ok;
+    }
+
+    // Same over a stream, e.g. a ChunkStream still being filled: products come
+    // out as their bytes arrive.
+    static bool Parse(std::istream &input, ProductCallback onProduct, PageInfo *pageInfo = nullptr)
+    {
+        ProductParser parser(std::move(onProduct));
+        const bool ok = nlohmann::json::sax_parse(input, &parser) && !parser.stopped;
+
+        if (pageInfo)
+        {
+            *pageInfo = parser.pageInfo;
+        }
+
+        return ok;
+    }
+
+    // SAX events; only called by nlohmann::json
+
+    bool null()
+    {
+        return true;
+    }
+
+    bool boolean(bool value)
+    {
+        return true;
+    }
+
+    bool number_integer(nlohmann::json::number_integer_t value)
+    {
+        return Number(static_cast<double>(value));
+    }
+
+    bool number_unsigned(nlohmann::json::number_unsigned_t value)
+    {
+        return Number(static_cast<double>(value));
+    }
+
+    bool number_float(nlohmann::json::number_float_t value, const nlohmann::json::string_t &text)
+    {
+        return Number(value);
+    }
+
+    bool string(nlohmann::json::string_t &value)
+    {
+        if (imagesDepth >= 0 && depth == imagesDepth)
+        {
+            product.imageUrls.push_back(std::move(value));
+        }
+        else if (InProductFields())
+        {
+            if (field == "title")
+                product.title = std::move(value);
+            else if (field == "brand")
+                product.brand = std::move(value);
+            else if (field == "category")
+                product.category = std::move(value);
+            else if (field == "description")
+                product.description = std::move(value);
+            else if (field == "thumbnail")
+                product.thumbnailUrl = std::move(value);
+        }
+
+        return true;
+    }
+
+    bool binary(nlohmann::json::binary_t &value)
+    {
+        return true;
+    }
+
+    bool start_object(std::size_t elements)
+    {
+        depth++;
+
+        if (productsDepth >= 0 && depth == productsDepth + 1)
+        {
+            productDepth = depth;
+            product = EmptyProduct();
+        }
+
+        return true;
+    }
+
+    bool end_object()
+    {
+        bool keepGoing = true;
+
+        if (depth == productDepth)
+        {
+            productDepth = -1;
+            keepGoing = onProduct(std::move(product));
+            stopped = !keepGoing;
+        }
+
+        depth--;
+        return keepGoing;
+    }
+
+    bool start_array(std::size_t elements)
+    {
+        depth++;
+
+        if (depth == 2 && rootKey == "products")
+        {
+            productsDepth = depth;
+        }
+        else if (productDepth >= 0 && depth == productDepth + 1 && field == "images")
+        {
+            imagesDepth = depth;
+        }
+
+        return true;
+    }
+
+    bool end_array()
+    {
+        if (depth == imagesDepth)
+        {
+            imagesDepth = -1;
+        }
+        else if (depth == productsDepth)
+        {
+            productsDepth = -1;
+        }
+
+        depth--;
+        return true;
+    }
+
+    bool key(nlohmann::json::string_t &value)
+    {
+        if (depth == 1)
+        {
+            rootKey = value;
+        }
+        else if (InProductFields())
+        {
+            field = value;
+        }
+
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string &lastToken, const nlohmann::json::exception &error)
+    {
+        return false;
+    }
+
+private:
+    explicit ProductParser(ProductCallback onProduct) : onProduct(std::move(onProduct)) {}
+
+    // same fallbacks as for missing fields in the DOM version
+    static Product EmptyProduct()
+    {
+        return Product{"Unknown Title", 0.0, "Unknown Brand", "Unknown Category", 0.0, "", {}, ""};
+    }
+
+    bool InProductFields() const
+    {
+        return productDepth >= 0 && depth == productDepth;
+    }
+
+    bool Number(double value)
+    {
+        if (depth == 1 && value >= 0)
+        {
+            if (rootKey == "total")
+                pageInfo.total = static_cast<size_t>(value);
+            else if (rootKey == "skip")
+                pageInfo.skip = static_cast<size_t>(value);
+            else if (rootKey == "limit")
+                pageInfo.limit = static_cast<size_t>(value);
+        }
+        else if (InProductFields())
+        {
+            if (field == "price")
+                product.price = value;
+            else if (field == "rating")
+                product.rating = value;
+        }
+
+        return true;
+    }
+
+    ProductCallback onProduct;
+    bool stopped = false;
+
+    PageInfo pageInfo;
+
+    // nesting depth of the current value; the root object is depth 1
+    int depth = 0;
+    int productsDepth = -1, productDepth = -1, imagesDepth = -1;
+
+    std::string rootKey, field;
+    Product product;
+};
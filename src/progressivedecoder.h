@@ -0,0 +1,586 @@
+#pragma once
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+extern "C"
+{
+#include <jpeglib.h>
+}
+
+#include <png.h>
+
+#include "pixelbufferpool.h"
+
+// Decodes an image from its bytes as they arrive, instead of from the whole
+// file: Feed takes each chunk once and the decoder keeps its state between
+// calls, so the cost is the same as one decode of the complete file however the
+// body is split up. Rows are written into a buffer from a PixelBufferPool, laid
+// out the way wxImage keeps them, and can be shown at any point.
+//
+// JPEG goes through libjpeg with a suspending source. Progressive JPEGs are read
+// in buffered-image mode: each scan that has come in is output over the whole
+// image, coarse first and sharper with every scan. PNG goes through libpng's
+// progressive reader; interlaced (Adam7) PNGs show the blocky early passes.
+// Rows not decoded yet are mid grey, or transparent in an image with alpha.
+//
+// One decoder must only be used by one thread at a time.
+class ProgressiveDecoder
+{
+public:
+    // enough of the start of a file to tell the formats apart
+    static constexpr size_t SignatureBytes = 8;
+
+    // larger images are refused rather than allocated
+    static constexpr size_t MaxPixels = 64 * 1024 * 1024;
+
+    virtual ~ProgressiveDecoder() = default;
+
+    ProgressiveDecoder(const ProgressiveDecoder &) = delete;
+    ProgressiveDecoder &operator=(const ProgressiveDecoder &) = delete;
+
+    // true if Create has a decoder for a file starting with `head`
+    static bool Supports(const unsigned char *head, size_t size)
+    {
+        return IsJpeg(head, size) || IsPng(head, size);
+    }
+
+    // a decoder for the format `head` announces, nullptr for any other
+    static std::unique_ptr<ProgressiveDecoder> Create(const unsigned char *head, size_t size, std::shared_ptr<PixelBufferPool> pool);
+
+    // Takes the next chunk of the file. Returns false once the data turned out
+    // to be broken; later calls do nothing then.
+    virtual bool Feed(const unsigned char *data, size_t size) = 0;
+
+    bool HasFailed() const
+    {
+        return failed;
+    }
+
+    // every row of the final image is written
+    bool IsComplete() const
+    {
+        return complete;
+    }
+
+    // the image in full size, written into while decoding; null until the header is read
+    const std::shared_ptr<PixelBuffer> &GetPixels() const
+    {
+        return pixels;
+    }
+
+    // rows written so far, counting each pass over the image, to tell whether
+    // showing the image again is worth it
+    size_t GetRowsWritten() const
+    {
+        return rowsWritten;
+    }
+
+protected:
+    explicit ProgressiveDecoder(std::shared_ptr<PixelBufferPool> pool) : pool(std::move(pool)) {}
+
+    bool AllocatePixels(size_t width, size_t height, bool alpha)
+    {
+        if (width == 0 || height == 0 || width > MaxPixels / height)
+        {
+            return false;
+        }
+
+        pixels = pool->Acquire(static_cast<int>(width), static_cast<int>(height), alpha);
+
+        std::memset(pixels->Rgb(), 128, width * height * 3);
+
+        if (alpha)
+        {
+            std::memset(pixels->Alpha(), 0, width * height);
+        }
+
+        return true;
+    }
+
+    std::shared_ptr<PixelBufferPool> pool;
+    std::shared_ptr<PixelBuffer> pixels;
+
+    bool failed = false;
+    bool complete = false;
+    size_t rowsWritten = 0;
+
+private:
+    static bool IsJpeg(const unsigned char *head, size_t size)
+    {
+        return size >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF;
+    }
+
+    static bool IsPng(const unsigned char *head, size_t size)
+    {
+        return size >= 8 && png_sig_cmp(const_cast<png_bytep>(head), 0, 8) == 0;
+    }
+};
+
+// Nothing between a setjmp and the library calls that may longjmp back to it
+// holds an object with a destructor, so the jump skips no cleanup.
+class JpegProgressiveDecoder : public ProgressiveDecoder
+{
+public:
+    explicit JpegProgressiveDecoder(std::shared_ptr<PixelBufferPool> pool) : ProgressiveDecoder(std::move(pool))
+    {
+        info.err = jpeg_std_error(&errors.manager);
+        errors.manager.error_exit = OnError;
+        errors.manager.output_message = OnMessage;
+
+        if (setjmp(errors.jump))
+        {
+            failed = true;
+            return;
+        }
+
+        jpeg_create_decompress(&info);
+        created = true;
+
+        source.manager.init_source = OnInitSource;
+        source.manager.fill_input_buffer = OnFillInput;
+        source.manager.skip_input_data = OnSkipInput;
+        source.manager.resync_to_restart = jpeg_resync_to_restart;
+        source.manager.term_source = OnTermSource;
+        source.manager.next_input_byte = nullptr;
+        source.manager.bytes_in_buffer = 0;
+        source.owner = this;
+
+        info.src = &source.manager;
+    }
+
+    ~JpegProgressiveDecoder()
+    {
+        if (created)
+        {
+            jpeg_destroy_decompress(&info);
+        }
+    }
+
+    bool Feed(const unsigned char *data, size_t size) override
+    {
+        if (failed || complete)
+        {
+            return !failed;
+        }
+
+        // what libjpeg has not consumed yet is offered again, followed by the new bytes
+        const size_t consumed = source.manager.next_input_byte ? source.manager.next_input_byte - input.data() : 0;
+        input.erase(input.begin(), input.begin() + consumed);
+
+        const size_t skipped = std::min(skipBytes, size);
+        skipBytes -= skipped;
+        input.insert(input.end(), data + skipped, data + size);
+
+        source.manager.next_input_byte = input.data();
+        source.manager.bytes_in_buffer = input.size();
+
+        if (setjmp(errors.jump))
+        {
+            failed = true;
+            return false;
+        }
+
+        Decode();
+
+        return !failed;
+    }
+
+private:
+    struct ErrorManager
+    {
+        jpeg_error_mgr manager;
+        std::jmp_buf jump;
+    };
+
+    struct Source
+    {
+        jpeg_source_mgr manager;
+        JpegProgressiveDecoder *owner;
+    };
+
+    enum class Stage
+    {
+        Header,
+        Start,
+        Sequential,
+        Buffered,
+        Done
+    };
+
+    static void OnError(j_common_ptr info)
+    {
+        std::longjmp(reinterpret_cast<ErrorManager *>(info->err)->jump, 1);
+    }
+
+    // warnings such as a truncated file; the decoder's state tells the caller
+    static void OnMessage(j_common_ptr) {}
+
+    static void OnInitSource(j_decompress_ptr) {}
+
+    static void OnTermSource(j_decompress_ptr) {}
+
+    // out of input: suspend until the next Feed
+    static boolean OnFillInput(j_decompress_ptr)
+    {
+        return FALSE;
+    }
+
+    static void OnSkipInput(j_decompress_ptr info, long count)
+    {
+        auto source = reinterpret_cast<Source *>(info->src);
+
+        if (count <= 0)
+        {
+            return;
+        }
+
+        // a skip past what has arrived carries over into the next chunks
+        if (static_cast<size_t>(count) > source->manager.bytes_in_buffer)
+        {
+            source->owner->skipBytes += count - source->manager.bytes_in_buffer;
+            source->manager.next_input_byte += source->manager.bytes_in_buffer;
+            source->manager.bytes_in_buffer = 0;
+        }
+        else
+        {
+            source->manager.next_input_byte += count;
+            source->manager.bytes_in_buffer -= count;
+        }
+    }
+
+    // runs until libjpeg suspends for more input or the image is done
+    void Decode()
+    {
+        if (stage == Stage::Header)
+        {
+            if (jpeg_read_header(&info, TRUE) == JPEG_SUSPENDED)
+            {
+                return;
+            }
+
+            // libjpeg does not convert CMYK; it is turned into RGB in StoreRow
+            cmyk = info.jpeg_color_space == JCS_CMYK || info.jpeg_color_space == JCS_YCCK;
+            info.out_color_space = cmyk ? JCS_CMYK : JCS_RGB;
+            info.buffered_image = jpeg_has_multiple_scans(&info);
+
+            stage = Stage::Start;
+        }
+
+        if (stage == Stage::Start)
+        {
+            if (!jpeg_start_decompress(&info))
+            {
+                return;
+            }
+
+            if (!AllocatePixels(info.output_width, info.output_height, false))
+            {
+                failed = true;
+                return;
+            }
+
+            if (cmyk)
+            {
+                row.resize(static_cast<size_t>(info.output_width) * 4);
+            }
+
+            stage = info.buffered_image ? Stage::Buffered : Stage::Sequential;
+        }
+
+        if (stage == Stage::Sequential)
+        {
+            if (!ReadScanlines())
+            {
+                return;
+            }
+
+            complete = true;
+            stage = Stage::Done;
+        }
+
+        if (stage == Stage::Buffered)
+        {
+            DecodeScans();
+        }
+    }
+
+    // Outputs the latest scan that has come in over the whole image, as far as
+    // its data goes, and again for every later scan; scans that arrive
+    // together are only output once. The pass after the last scan is final.
+    void DecodeScans()
+    {
+        for (;;)
+        {
+            if (!outputStarted)
+            {
+                int status;
+
+                do
+                {
+                    status = jpeg_consume_input(&info);
+                } while (status != JPEG_SUSPENDED && status != JPEG_REACHED_EOI);
+
+                finalPass = jpeg_input_complete(&info);
+
+                // that scan has been shown as far as it goes; wait for the next
+                if (!finalPass && info.input_scan_number == lastOutputScan)
+                {
+                    return;
+                }
+
+                if (!jpeg_start_output(&info, info.input_scan_number))
+                {
+                    return;
+                }
+
+                outputStarted = true;
+            }
+
+            if (!ReadScanlines() || !jpeg_finish_output(&info))
+            {
+                return;
+            }
+
+            outputStarted = false;
+            lastOutputScan = info.output_scan_number;
+
+            if (finalPass)
+            {
+                complete = true;
+                stage = Stage::Done;
+                return;
+            }
+        }
+    }
+
+    // false when suspended before the last row of the pass
+    bool ReadScanlines()
+    {
+        while (info.output_scanline < info.output_height)
+        {
+            const size_t line = info.output_scanline;
+            unsigned char *rgb = pixels->Rgb() + line * info.output_width * 3;
+
+            // RGB rows have the layout of the pixel buffer and go straight in
+            JSAMPROW rows[1] = {cmyk ? row.data() : rgb};
+
+            if (jpeg_read_scanlines(&info, rows, 1) != 1)
+            {
+                return false;
+            }
+
+            if (cmyk)
+            {
+                StoreCmykRow(rgb);
+            }
+
+            rowsWritten++;
+        }
+
+        return true;
+    }
+
+    // Adobe writes CMYK inverted, as nearly every CMYK JPEG is; wx assumes the same
+    void StoreCmykRow(unsigned char *rgb)
+    {
+        const unsigned char *cmykRow = row.data();
+
+        for (size_t x = 0; x < info.output_width; x++, cmykRow += 4)
+        {
+            const unsigned k = cmykRow[3];
+
+            *rgb++ = static_cast<unsigned char>(cmykRow[0] * k / 255);
+            *rgb++ = static_cast<unsigned char>(cmykRow[1] * k / 255);
+            *rgb++ = static_cast<unsigned char>(cmykRow[2] * k / 255);
+        }
+    }
+
+    jpeg_decompress_struct info{};
+    ErrorManager errors{};
+    Source source{};
+    bool created = false;
+
+    // bytes received but not consumed by libjpeg yet; a few KB at most
+    std::vector<unsigned char> input;
+    size_t skipBytes = 0;
+
+    Stage stage = Stage::Header;
+    bool cmyk = false;
+    std::vector<unsigned char> row;
+
+    bool outputStarted = false, finalPass = false;
+    int lastOutputScan = 0;
+};
+
+// Nothing between the setjmp in Feed and the libpng calls that may longjmp back
+// to it, the callbacks included, holds an object with a destructor.
+class PngProgressiveDecoder : public ProgressiveDecoder
+{
+public:
+    explicit PngProgressiveDecoder(std::shared_ptr<PixelBufferPool> pool) : ProgressiveDecoder(std::move(pool))
+    {
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, OnError, OnWarning);
+        info = png ? png_create_info_struct(png) : nullptr;
+
+        if (!info)
+        {
+            failed = true;
+            return;
+        }
+
+        png_set_progressive_read_fn(png, this, OnInfo, OnRow, OnEnd);
+    }
+
+    ~PngProgressiveDecoder()
+    {
+        if (png)
+        {
+            png_destroy_read_struct(&png, info ? &info : nullptr, nullptr);
+        }
+    }
+
+    bool Feed(const unsigned char *data, size_t size) override
+    {
+        if (failed || complete)
+        {
+            return !failed;
+        }
+
+        if (setjmp(png_jmpbuf(png)))
+        {
+            failed = true;
+            return false;
+        }
+
+        png_process_data(png, info, const_cast<png_bytep>(data), size);
+
+        return !failed;
+    }
+
+private:
+    static PngProgressiveDecoder &Owner(png_structp png)
+    {
+        return *static_cast<PngProgressiveDecoder *>(png_get_progressive_ptr(png));
+    }
+
+    static void OnError(png_structp png, png_const_charp)
+    {
+        png_longjmp(png, 1);
+    }
+
+    static void OnWarning(png_structp, png_const_charp) {}
+
+    // everything comes out as 8-bit RGB or RGBA
+    static void OnInfo(png_structp png, png_infop info)
+    {
+        PngProgressiveDecoder &decoder = Owner(png);
+
+        png_set_expand(png); // palette, low bit depths and tRNS
+        png_set_strip_16(png);
+        png_set_gray_to_rgb(png);
+
+        decoder.interlaced = png_set_interlace_handling(png) > 1;
+        png_read_update_info(png, info);
+
+        decoder.alpha = png_get_channels(png, info) == 4;
+
+        if (!decoder.AllocatePixels(png_get_image_width(png, info), png_get_image_height(png, info), decoder.alpha))
+        {
+            decoder.failed = true;
+            png_longjmp(png, 1);
+        }
+
+        if (decoder.alpha)
+        {
+            decoder.row.resize(static_cast<size_t>(decoder.pixels->GetWidth()) * 4);
+        }
+    }
+
+    // For an interlaced image every row is passed once per pass, null where the
+    // pass has nothing for it; libpng combines the pixels of the pass into the
+    // row shown so far, replicated into blocks.
+    static void OnRow(png_structp png, png_bytep newRow, png_uint_32 rowNumber, int)
+    {
+        PngProgressiveDecoder &decoder = Owner(png);
+
+        if (!newRow || rowNumber >= static_cast<png_uint_32>(decoder.pixels->GetHeight()))
+        {
+            return;
+        }
+
+        const size_t width = decoder.pixels->GetWidth();
+        unsigned char *rgb = decoder.pixels->Rgb() + rowNumber * width * 3;
+
+        if (!decoder.alpha)
+        {
+            if (decoder.interlaced)
+            {
+                png_progressive_combine_row(png, rgb, newRow);
+            }
+            else
+            {
+                std::memcpy(rgb, newRow, width * 3);
+            }
+        }
+        else
+        {
+            unsigned char *alpha = decoder.pixels->Alpha() + rowNumber * width;
+            unsigned char *rgba = decoder.row.data();
+
+            if (decoder.interlaced)
+            {
+                // libpng combines into its own interleaved layout
+                for (size_t x = 0; x < width; x++)
+                {
+                    std::memcpy(rgba + x * 4, rgb + x * 3, 3);
+                    rgba[x * 4 + 3] = alpha[x];
+                }
+
+                png_progressive_combine_row(png, rgba, newRow);
+            }
+            else
+            {
+                rgba = newRow;
+            }
+
+            for (size_t x = 0; x < width; x++)
+            {
+                std::memcpy(rgb + x * 3, rgba + x * 4, 3);
+                alpha[x] = rgba[x * 4 + 3];
+            }
+        }
+
+        decoder.rowsWritten++;
+    }
+
+    static void OnEnd(png_structp png, png_infop)
+    {
+        Owner(png).complete = true;
+    }
+
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+
+    bool interlaced = false, alpha = false;
+    std::vector<unsigned char> row; // RGBA, for combining interlaced rows
+};
+
+inline std::unique_ptr<ProgressiveDecoder> ProgressiveDecoder::Create(const unsigned char *head, size_t size, std::shared_ptr<PixelBufferPool> pool)
+{
+    if (IsJpeg(head, size))
+    {
+        return std::make_unique<JpegProgressiveDecoder>(std::move(pool));
+    }
+
+    if (IsPng(head, size))
+    {
+        return std::make_unique<PngProgressiveDecoder>(std::move(pool));
+    }
+
+    return nullptr;
+}
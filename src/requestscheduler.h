@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+enum class RequestPriority : int
+{
+    Visible = 0, // the image the gallery is waiting on right now
+    Current,     // the rest of the current product
+    Prefetch     // neighbouring products
+};
+
+static constexpr size_t RequestPriorityCount = 3;
+
+// Decides which URL to download next. Jobs are keyed by URL and reference counted:
+// every consumer (a gallery slot, a prefetch window entry) holds a claim, duplicate
+// requests share one download, and a job is only dropped with its last claim. Queued jobs
+// start in (priority, submission order); prefetch jobs only start when nothing
+// more important is queued or downloading.
+//
+// A job goes queued -> in flight (downloading) -> decoding -> completed. Only the
+// in-flight stage counts against the concurrency limits.
+class RequestScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct PriorityStats
+    {
+        size_t queued = 0;
+        size_t inFlight = 0;
+        size_t completed = 0;
+
+        double totalLatencyMs = 0;
+        double maxLatencyMs = 0;
+
+        double MeanLatencyMs() const
+        {
+            return completed > 0 ? totalLatencyMs / completed : 0;
+        }
+    };
+
+    struct Stats
+    {
+        std::array<PriorityStats, RequestPriorityCount> priorities;
+
+        // consumers that joined an existing job instead of starting a request
+        size_t coalesced = 0;
+
+        size_t QueueDepth() const
+        {
+            size_t depth = 0;
+
+            for (const auto &priority : priorities)
+            {
+                depth += priority.queued;
+            }
+
+            return depth;
+        }
+
+        size_t InFlight() const
+        {
+            size_t count = 0;
+
+            for (const auto &priority : priorities)
+            {
+                count += priority.inFlight;
+            }
+
+            return count;
+        }
+    };
+
+    RequestScheduler(size_t maxInFlight, size_t maxPrefetchInFlight)
+        : maxInFlight(maxInFlight), maxPrefetchInFlight(maxPrefetchInFlight)
+    {
+    }
+
+    // Registers one consumer of the URL at the given priority. A URL that is
+    // already queued or downloading is not requested again: the consumer joins the
+    // existing job, which runs at the highest priority any consumer asked for.
+    // Returns true if a new job was created.
+    bool Acquire(const std::string &url, RequestPriority priority)
+    {
+        auto it = jobs.find(url);
+
+        if (it == jobs.end())
+        {
+            Job job;
+            job.claims[Index(priority)] = 1;
+            job.priority = priority;
+            job.sequence = nextSequence++;
+            job.enqueued = Clock::now();
+
+            jobs[url] = job;
+            queue.insert({static_cast<int>(priority), job.sequence, url});
+            return true;
+        }
+
+        it->second.claims[Index(priority)]++;
+        coalesced++;
+
+        UpdatePriority(url, it->second);
+        return false;
+    }
+
+    // Removes one consumer. The job survives as long as anyone else still wants it;
+    // returns true if this was the last consumer of a download in flight, so the
+    // caller knows to cancel the transfer.
+    bool Release(const std::string &url, RequestPriority priority)
+    {
+        auto it = jobs.find(url);
+
+        if (it == jobs.end())
+        {
+            return false;
+        }
+
+        Job &job = it->second;
+
+        if (job.claims[Index(priority)] > 0)
+        {
+            job.claims[Index(priority)]--;
+        }
+
+        if (ClaimCount(job) == 0)
+        {
+            return Drop(url);
+        }
+
+        UpdatePriority(url, job);
+        return false;
+    }
+
+    // Changes the priority of one consumer without ever leaving the job unclaimed.
+    void Move(const std::string &url, RequestPriority from, RequestPriority to)
+    {
+        auto it = jobs.find(url);
+
+        if (it == jobs.end() || it->second.claims[Index(from)] == 0)
+        {
+            return;
+        }
+
+        it->second.claims[Index(from)]--;
+        it->second.claims[Index(to)]++;
+
+        UpdatePriority(url, it->second);
+    }
+
+    // Forgets the URL regardless of its consumers. Returns true if it was
+    // downloading, so the caller knows to cancel the transfer.
+    bool Drop(const std::string &url)
+    {
+        auto it = jobs.find(url);
+
+        if (it == jobs.end())
+        {
+            return false;
+        }
+
+        const Job job = it->second;
+        jobs.erase(it);
+
+        if (job.stage == Stage::Queued)
+        {
+            queue.erase({static_cast<int>(job.priority), job.sequence, url});
+        }
+        else if (job.stage == Stage::InFlight)
+        {
+            inFlightCount[Index(job.priority)]--;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Marks the most important startable job as in flight and returns its URL.
+    std::optional<std::string> StartNext(bool allowPrefetch = true)
+    {
+        if (queue.empty() || InFlightTotal() >= maxInFlight)
+        {
+            return std::nullopt;
+        }
+
+        const auto [priority, sequence, url] = *queue.begin();
+
+        if (priority == static_cast<int>(RequestPriority::Prefetch))
+        {
+            const bool moreImportantInFlight = inFlightCount[Index(RequestPriority::Visible)] + inFlightCount[Index(RequestPriority::Current)] > 0;
+
+            if (!allowPrefetch || moreImportantInFlight || inFlightCount[Index(RequestPriority::Prefetch)] >= maxPrefetchInFlight)
+            {
+                return std::nullopt;
+            }
+        }
+
+        queue.erase(queue.begin());
+
+        Job &job = jobs[url];
+        job.stage = Stage::InFlight;
+        inFlightCount[priority]++;
+
+        return url;
+    }
+
+    // The download finished; the job stays known (so it is not requested again)
+    // but no longer takes up a download slot.
+    void MarkDownloaded(const std::string &url)
+    {
+        auto it = jobs.find(url);
+
+        if (it != jobs.end() && it->second.stage == Stage::InFlight)
+        {
+            inFlightCount[Index(it->second.priority)]--;
+            it->second.stage = Stage::Decoding;
+        }
+    }
+
+    // Removes the job and records its queue-to-completion latency.
+    void Complete(const std::string &url)
+    {
+        auto it = jobs.find(url);
+
+        if (it == jobs.end())
+        {
+            return;
+        }
+
+        MarkDownloaded(url);
+
+        const Job &job = it->second;
+        const double latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - job.enqueued).count();
+
+        auto &stats = completedStats[Index(job.priority)];
+        stats.completed++;
+        stats.totalLatencyMs += latencyMs;
+        stats.maxLatencyMs = std::max(stats.maxLatencyMs, latencyMs);
+
+        jobs.erase(it);
+    }
+
+    bool Contains(const std::string &url) const
+    {
+        return jobs.count(url) > 0;
+    }
+
+    std::vector<std::string> Urls() const
+    {
+        std::vector<std::string> urls;
+        urls.reserve(jobs.size());
+
+        for (const auto &[url, job] : jobs)
+        {
+            urls.push_back(url);
+        }
+
+        return urls;
+    }
+
+    void SetMaxInFlight(size_t count)
+    {
+        maxInFlight = count;
+    }
+
+    size_t GetMaxInFlight() const
+    {
+        return maxInFlight;
+    }
+
+    Stats GetStats() const
+    {
+        Stats stats;
+
+        for (size_t i = 0; i < RequestPriorityCount; i++)
+        {
+            stats.priorities[i] = completedStats[i];
+            stats.priorities[i].inFlight = inFlightCount[i];
+        }
+
+        for (const auto &[priority, sequence, url] : queue)
+        {
+            stats.priorities[priority].queued++;
+        }
+
+        stats.coalesced = coalesced;
+
+        return stats;
+    }
+
+private:
+    enum class Stage
+    {
+        Queued,
+        InFlight,
+        Decoding
+    };
+
+    struct Job
+    {
+        std::array<size_t, RequestPriorityCount> claims = {};
+        RequestPriority priority = RequestPriority::Current;
+        Stage stage = Stage::Queued;
+        unsigned long sequence = 0;
+        Clock::time_point enqueued;
+    };
+
+    static size_t Index(RequestPriority priority)
+    {
+        return static_cast<size_t>(priority);
+    }
+
+    static size_t ClaimCount(const Job &job)
+    {
+        return job.claims[0] + job.claims[1] + job.claims[2];
+    }
+
+    // a job runs at the highest priority any of its consumers holds
+    void UpdatePriority(const std::string &url, Job &job)
+    {
+        RequestPriority priority = RequestPriority::Prefetch;
+
+        for (size_t i = 0; i < RequestPriorityCount; i++)
+        {
+            if (job.claims[i] > 0)
+            {
+                priority = static_cast<RequestPriority>(i);
+                break;
+            }
+        }
+
+        if (job.priority == priority)
+        {
+            return;
+        }
+
+        if (job.stage == Stage::Queued)
+        {
+            queue.erase({static_cast<int>(job.priority), job.sequence, url});
+            job.sequence = nextSequence++;
+            queue.insert({static_cast<int>(priority), job.sequence, url});
+        }
+        else if (job.stage == Stage::InFlight)
+        {
+            inFlightCount[Index(job.priority)]--;
+            inFlightCount[Index(priority)]++;
+        }
+
+        job.priority = priority;
+    }
+
+    size_t InFlightTotal() const
+    {
+        return inFlightCount[0] + inFlightCount[1] + inFlightCount[2];
+    }
+
+    size_t maxInFlight;
+    size_t maxPrefetchInFlight;
+
+    std::unordered_map<std::string, Job> jobs;
+    std::set<std::tuple<int, unsigned long, std::string>> queue;
+    unsigned long nextSequence = 0;
+    size_t coalesced = 0;
+
+    std::array<size_t, RequestPriorityCount> inFlightCount = {};
+    std::array<PriorityStats, RequestPriorityCount> completedStats = {};
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <wx/wx.h>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bitmaploader.h"
+#include "metrics.h"
+
+// Scripted navigation for end-to-end runs against a test server
+// (tools/mockserver.py). Once the first product's gallery has loaded, the
+// driver clicks through one of the scenarios below on a timer, then closes the
+// window and prints one JSON object with what the run cost:
+//
+//     first_image_ms        launch until the first image appeared in the gallery
+//     batch_*               per gallery batch that completed before being replaced
+//     wasted_bytes          image bytes received by requests that were thrown away
+//     close_ms              close requested until the window actually went
+//     peak_rss_bytes        peak resident memory of the process
+//     pixel_buffers         downscale buffers taken from the pool, and how many were new
+//     histograms            the pipeline stages from Metrics
+//     error                 why the run gave up, null if it did not
+//
+// A run gives up, closing the window and reporting what it has, if the first
+// gallery has not loaded StepTimeoutMs after launch.
+//
+// Scenarios:
+//     rapid      20 Next and 10 Prev, 50 ms apart, faster than the images arrive
+//     midflight  Next every 300 ms, so each batch replaces one still downloading
+//     close      Next, then close 100 ms later, in the middle of the downloads
+//     all        midflight, then rapid, then close
+class ScenarioDriver : public wxEvtHandler
+{
+public:
+    static constexpr int StepTimeoutMs = 60000;
+
+    struct Actions
+    {
+        std::function<bool()> ready;
+        std::function<void()> next, previous, close;
+    };
+
+    struct Step
+    {
+        enum class Kind
+        {
+            Next,
+            Previous,
+            WaitForGallery,
+            Close
+        };
+
+        Kind kind;
+        int delayMs = 0; // before the step
+    };
+
+    static std::optional<std::vector<Step>> Scenario(const std::string &name)
+    {
+        using Kind = Step::Kind;
+
+        std::vector<Step> rapid;
+
+        for (int i = 0; i < 20; i++)
+        {
+            rapid.push_back({Kind::Next, 50});
+        }
+
+        for (int i = 0; i < 10; i++)
+        {
+            rapid.push_back({Kind::Previous, 50});
+        }
+
+        rapid.push_back({Kind::WaitForGallery});
+
+        std::vector<Step> midflight;
+
+        for (int i = 0; i < 10; i++)
+        {
+            midflight.push_back({Kind::Next, 300});
+        }
+
+        midflight.push_back({Kind::WaitForGallery});
+
+        const std::vector<Step> close = {{Kind::Next}, {Kind::Close, 100}};
+
+        std::vector<Step> steps;
+
+        if (name == "rapid")
+        {
+            steps = rapid;
+        }
+        else if (name == "midflight")
+        {
+            steps = midflight;
+        }
+        else if (name == "close")
+        {
+            return close;
+        }
+        else if (name == "all")
+        {
+            steps = midflight;
+            steps.insert(steps.end(), rapid.begin(), rapid.end());
+            steps.insert(steps.end(), close.begin(), close.end());
+            return steps;
+        }
+        else
+        {
+            return std::nullopt;
+        }
+
+        steps.push_back({Kind::Close});
+        return steps;
+    }
+
+    ScenarioDriver(const std::string &name, std::vector<Step> steps, Actions actions, BitmapLoader *bitmapLoader)
+        : name(name), steps(std::move(steps)), actions(std::move(actions)), bitmapLoader(bitmapLoader)
+    {
+        bitmapLoader->SetOnBatchComplete([this](const BitmapLoader::BatchTiming &timing)
+                                         { OnBatchComplete(timing); });
+
+        timer.SetOwner(this);
+        this->Bind(wxEVT_TIMER, &ScenarioDriver::OnTimer, this);
+        timer.Start(PollIntervalMs);
+    }
+
+    ~ScenarioDriver()
+    {
+        bitmapLoader->SetOnBatchComplete(nullptr);
+    }
+
+    // call when the window is finally closing; prints the report
+    void Finish()
+    {
+        timer.Stop();
+
+        const auto now = std::chrono::steady_clock::now();
+        const auto stats = bitmapLoader->GetLoadStats();
+        const auto pixelStats = bitmapLoader->GetPixelPoolStats();
+
+        nlohmann::json report = {{"scenario", name},
+                                 {"error", error ? nlohmann::json(*error) : nlohmann::json()},
+                                 {"steps_run", nextStep},
+                                 {"steps_total", steps.size()},
+                                 {"total_ms", MsBetween(launch, now)},
+                                 {"first_image_ms", firstImageMs ? nlohmann::json(*firstImageMs) : nlohmann::json()},
+                                 {"batches_started", stats.batchesStarted},
+                                 {"batches_completed", stats.batchesCompleted},
+                                 {"received_bytes", stats.bytesReceived},
+                                 {"wasted_bytes", stats.wastedBytes},
+                                 {"cancelled_requests", stats.cancelledRequests},
+                                 {"close_ms", closeRequested ? nlohmann::json(MsBetween(*closeRequested, now)) : nlohmann::json()},
+                                 {"peak_rss_bytes", Metrics::PeakResidentBytes()},
+                                 {"pixel_buffers", {{"acquired", pixelStats.acquired}, {"allocated", pixelStats.allocated}, {"retained_bytes", pixelStats.retainedBytes}}},
+                                 {"histograms", Metrics::Get().ToJson()["histograms"]}};
+
+        if (!batchFirstImageMs.empty())
+        {
+            report["batch_first_image_ms"] = Summary(batchFirstImageMs);
+            report["batch_complete_ms"] = Summary(batchCompleteMs);
+        }
+
+        std::printf("%s\n", report.dump().c_str());
+        std::fflush(stdout);
+    }
+
+private:
+    static constexpr int PollIntervalMs = 10;
+
+    static double MsBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+    {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    static nlohmann::json Summary(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+
+        double sum = 0;
+
+        for (double value : values)
+        {
+            sum += value;
+        }
+
+        return {{"count", values.size()}, {"mean", sum / values.size()}, {"median", values[values.size() / 2]}, {"max", values.back()}};
+    }
+
+    void OnBatchComplete(const BitmapLoader::BatchTiming &timing)
+    {
+        if (!firstImageMs && timing.imageCount > 0)
+        {
+            // the first batch is started when the first product arrives
+            firstImageMs = MsBetween(launch, std::chrono::steady_clock::now()) - (timing.completeMs - timing.firstImageMs);
+        }
+
+        galleryComplete = true;
+
+        if (started)
+        {
+            batchFirstImageMs.push_back(timing.firstImageMs);
+            batchCompleteMs.push_back(timing.completeMs);
+        }
+    }
+
+    void OnTimer(wxTimerEvent &event)
+    {
+        const auto now = std::chrono::steady_clock::now();
+
+        if (!started)
+        {
+            // the first product's gallery is the startup measurement; the script
+            // starts once it is complete
+            if (!actions.ready() || !galleryComplete)
+            {
+                if (MsBetween(launch, now) >= StepTimeoutMs && !closeRequested)
+                {
+                    error = "the first gallery did not load within " + std::to_string(StepTimeoutMs) + " ms";
+                    closeRequested = now;
+                    actions.close();
+                }
+
+                return;
+            }
+
+            started = true;
+            stepStart = now;
+        }
+
+        if (nextStep >= steps.size() || closeRequested)
+        {
+            return;
+        }
+
+        const Step &step = steps[nextStep];
+
+        if (MsBetween(stepStart, now) < step.delayMs)
+        {
+            return;
+        }
+
+        if (step.kind == Step::Kind::WaitForGallery && !galleryComplete && MsBetween(stepStart, now) < StepTimeoutMs)
+        {
+            return;
+        }
+
+        nextStep++;
+        stepStart = now;
+
+        switch (step.kind)
+        {
+        case Step::Kind::Next:
+            galleryComplete = false;
+            actions.next();
+            break;
+        case Step::Kind::Previous:
+            galleryComplete = false;
+            actions.previous();
+            break;
+        case Step::Kind::Close:
+            closeRequested = now;
+            actions.close();
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::string name;
+    std::vector<Step> steps;
+    Actions actions;
+    BitmapLoader *bitmapLoader;
+
+    wxTimer timer;
+    const std::chrono::steady_clock::time_point launch = std::chrono::steady_clock::now();
+
+    bool started = false;
+    size_t nextStep = 0;
+    std::chrono::steady_clock::time_point stepStart;
+
+    bool galleryComplete = false;
+    std::optional<double> firstImageMs;
+    std::vector<double> batchFirstImageMs, batchCompleteMs;
+    std::optional<std::chrono::steady_clock::time_point> closeRequested;
+    std::optional<std::string> error;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+// Small fixed-size thread pool for CPU work that must stay off the GUI thread.
+// Tasks must not touch GUI objects; results are posted back with CallAfter.
+class WorkerPool
+{
+public:
+    static size_t DefaultThreadCount()
+    {
+        return std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, 4);
+    }
+
+    WorkerPool(size_t threadCount = DefaultThreadCount())
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, threadCount); i++)
+        {
+            workers.emplace_back([this]()
+                                 { Run(); });
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            tasks.clear();
+        }
+
+        wakeUp.notify_all();
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void Submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+
+        wakeUp.notify_one();
+    }
+
+    size_t GetThreadCount() const
+    {
+        return workers.size();
+    }
+
+private:
+    void Run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [this]()
+                            { return stopping || !tasks.empty(); });
+
+                if (stopping)
+                {
+                    return;
+                }
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+};
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""Local stand-in for the dummyjson products API, for repeatable end-to-end runs.
+
+Serves a synthetic catalog at /products (limit/skip/total, like dummyjson) and
+generated images under /images/, with knobs for the things that make the
+loaders interesting: latency, bandwidth, failures and image size.
+
+    python3 tools/mockserver.py --port 8000 --latency-ms 80 --bandwidth-kbps 2000
+    ./main --base-url=http://127.0.0.1:8000/products --drive=all --clear-cache
+
+Only the Python standard library (3.9+) is needed. Images are PNG unless
+--image-format jpeg is given, which needs Pillow. PNG pixels are noise, so the
+file size is close to width * height * 3 and easy to reason about.
+"""
+
+import argparse
+import hashlib
+import io
+import json
+import random
+import struct
+import threading
+import time
+import zlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+BRANDS = ["Apple", "Samsung", "Dell", "Lenovo", "Asus", "Sony", "Nike", "Adidas", "Ikea", "Bosch"]
+CATEGORIES = ["laptops", "smartphones", "furniture", "groceries", "beauty", "fragrances", "tablets", "sports"]
+WORDS = "sleek durable compact premium lightweight wireless classic modern everyday portable".split()
+
+
+def make_product(index, options, base):
+    rng = random.Random(options.seed * 1000003 + index)
+    product_id = index + 1
+
+    images = ["%s/images/%d/%d.%s" % (base, product_id, n + 1, options.image_format)
+              for n in range(options.images_per_product)]
+
+    return {
+        "id": product_id,
+        "title": "%s %s %d" % (rng.choice(WORDS).capitalize(), rng.choice(CATEGORIES), product_id),
+        "description": " ".join(rng.choice(WORDS) for _ in range(options.description_words)),
+        "category": rng.choice(CATEGORIES),
+        "price": round(rng.uniform(1, 2000), 2),
+        "rating": round(rng.uniform(1, 5), 2),
+        "brand": rng.choice(BRANDS),
+        "images": images,
+        "thumbnail": "%s/images/%d/thumbnail.%s" % (base, product_id, options.image_format),
+    }
+
+
+def pixels(width, height, seed):
+    return random.Random(seed).randbytes(width * height * 3)
+
+
+def png(width, height, seed):
+    data = pixels(width, height, seed)
+    stride = width * 3
+    raw = b"".join(b"\x00" + data[y * stride:(y + 1) * stride] for y in range(height))
+
+    def chunk(kind, data):
+        return struct.pack(">I", len(data)) + kind + data + struct.pack(">I", zlib.crc32(kind + data))
+
+    header = struct.pack(">IIBBBBB", width, height, 8, 2, 0, 0, 0)
+    return b"\x89PNG\r\n\x1a\n" + chunk(b"IHDR", header) + chunk(b"IDAT", zlib.compress(raw, 1)) + chunk(b"IEND", b"")
+
+
+def jpeg(width, height, seed):
+    from PIL import Image  # only needed for --image-format jpeg
+
+    image = Image.frombytes("RGB", (width, height), pixels(width, height, seed))
+    out = io.BytesIO()
+    image.save(out, "JPEG", quality=85)
+    return out.getvalue()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    options = None
+    images = {}
+    images_lock = threading.Lock()
+
+    # requests seen per path, so each request's latency and failure draw
+    # depends only on the path and how often it was asked for, not on which
+    # thread got there first
+    request_counts = {}
+    request_counts_lock = threading.Lock()
+
+    def log_message(self, format, *args):
+        if self.options.verbose:
+            super().log_message(format, *args)
+
+    def do_GET(self):
+        options = self.options
+        url = urlparse(self.path)
+        rng = self.request_rng()
+
+        if options.latency_ms > 0:
+            time.sleep(rng.uniform(0.5, 1.5) * options.latency_ms / 1000)
+
+        if rng.random() < options.error_rate:
+            return self.send_body(500, b'{"message":"injected failure"}', "application/json")
+
+        if url.path.rstrip("/") == "/products":
+            return self.send_products(parse_qs(url.query))
+
+        parts = url.path.strip("/").split("/")
+
+        if len(parts) == 3 and parts[0] == "images":
+            return self.send_image(parts[1], parts[2])
+
+        self.send_body(404, b'{"message":"not found"}', "application/json")
+
+    def request_rng(self):
+        with self.request_counts_lock:
+            count = self.request_counts.get(self.path, 0)
+            self.request_counts[self.path] = count + 1
+
+        return random.Random(zlib.crc32(("%d/%s/%d" % (self.options.seed, self.path, count)).encode()))
+
+    def send_products(self, query):
+        options = self.options
+        limit = int(query.get("limit", ["30"])[0])
+        skip = int(query.get("skip", ["0"])[0])
+
+        base = "http://%s" % self.headers.get("Host", "127.0.0.1:%d" % options.port)
+        end = min(options.products, skip + limit)
+        products = [make_product(i, options, base) for i in range(skip, end)]
+
+        body = json.dumps({"products": products, "total": options.products, "skip": skip, "limit": limit}).encode()
+        self.send_body(200, body, "application/json")
+
+    def send_image(self, product, name):
+        options = self.options
+        key = (product, name)
+
+        with self.images_lock:
+            body = self.images.get(key)
+
+        if body is None:
+            thumbnail = name.startswith("thumbnail")
+            width, height = options.thumbnail_size if thumbnail else options.image_size
+            seed = zlib.crc32(("%s/%s/%d" % (product, name, options.seed)).encode())
+            body = jpeg(width, height, seed) if options.image_format == "jpeg" else png(width, height, seed)
+
+            with self.images_lock:
+                self.images[key] = body
+
+        content_type = "image/jpeg" if options.image_format == "jpeg" else "image/png"
+        self.send_body(200, body, content_type)
+
+    def send_body(self, status, body, content_type):
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()
+
+        if status == 200 and self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("Cache-Control", "max-age=%d" % self.options.max_age)
+        self.send_header("ETag", etag)
+        self.end_headers()
+
+        try:
+            self.write_throttled(body)
+        except (BrokenPipeError, ConnectionResetError):
+            pass  # the client cancelled
+
+    # bandwidth is per connection, like a slow link shared by nothing else
+    def write_throttled(self, body):
+        bandwidth = self.options.bandwidth_kbps * 1000 / 8
+
+        if bandwidth <= 0:
+            self.wfile.write(body)
+            return
+
+        chunk = max(1024, int(bandwidth / 20))
+        start = time.monotonic()
+        sent = 0
+
+        while sent < len(body):
+            self.wfile.write(body[sent:sent + chunk])
+            sent += chunk
+            ahead = sent / bandwidth - (time.monotonic() - start)
+
+            if ahead > 0:
+                time.sleep(ahead)
+
+
+def size(text):
+    width, height = text.lower().split("x")
+    return int(width), int(height)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--products", type=int, default=1000, help="catalog size")
+    parser.add_argument("--images-per-product", type=int, default=4)
+    parser.add_argument("--image-size", type=size, default=(800, 600), help="WxH of product images")
+    parser.add_argument("--thumbnail-size", type=size, default=(160, 120), help="WxH of thumbnails")
+    parser.add_argument("--image-format", choices=["png", "jpeg"], default="png")
+    parser.add_argument("--description-words", type=int, default=40)
+    parser.add_argument("--latency-ms", type=float, default=0, help="mean delay before each response")
+    parser.add_argument("--bandwidth-kbps", type=float, default=0, help="per-connection limit, 0 for none")
+    parser.add_argument("--error-rate", type=float, default=0, help="fraction of requests answered with 500")
+    parser.add_argument("--max-age", type=int, default=0, help="Cache-Control max-age in seconds")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--verbose", action="store_true")
+    options = parser.parse_args()
+
+    Handler.options = options
+
+    server = ThreadingHTTPServer(("127.0.0.1", options.port), Handler)
+    print("Serving %d products on http://127.0.0.1:%d/products" % (options.products, options.port), flush=True)
+
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()